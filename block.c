@@ -29,6 +29,7 @@
 #include "block/blockjob.h"
 #include "qemu/module.h"
 #include "qapi/qmp/qjson.h"
+#include "qapi/qmp/qint.h"
 #include "sysemu/sysemu.h"
 #include "qemu/notify.h"
 #include "block/coroutine.h"
@@ -88,10 +89,20 @@ static bool bdrv_exceed_iops_limits(BlockDriverState *bs, bool is_write,
         double elapsed_time, uint64_t *wait);
 static bool bdrv_exceed_io_limits(BlockDriverState *bs, int nb_sectors,
         bool is_write, int64_t *wait);
+static void bdrv_set_dirty(BlockDriverState *bs, int64_t cur_sector,
+                           int nr_sectors);
+static void bdrv_reset_dirty(BlockDriverState *bs, int64_t cur_sector,
+                             int nr_sectors);
+static bool bdrv_has_named_dirty_bitmaps(BlockDriverState *bs);
+static void bdrv_release_named_dirty_bitmaps(BlockDriverState *bs);
 
 static QTAILQ_HEAD(, BlockDriverState) bdrv_states =
     QTAILQ_HEAD_INITIALIZER(bdrv_states);
 
+/* device_name -> BlockDriverState for everything in bdrv_states, so that
+   bdrv_find does not have to walk the list */
+static GHashTable *bdrv_names;
+
 static QLIST_HEAD(, BlockDriver) bdrv_drivers =
     QLIST_HEAD_INITIALIZER(bdrv_drivers);
 
@@ -160,12 +171,134 @@ bool bdrv_io_limits_enabled(BlockDriverState *bs)
          || io_limits->iops[BLOCK_IO_LIMIT_TOTAL];
 }
 
+/* Throttle queue events.  A drive's queue is "queued" while requests wait
+ * for the limits, "saturated" once it has stayed non-empty for a whole
+ * interval, and "drained" when it empties again.  Changes are reported at
+ * most once per interval; a saturated queue is reported again every
+ * interval, so the stats deltas in the event double as periodic stats.
+ */
+enum {
+    THROTTLE_EVENT_DRAINED,
+    THROTTLE_EVENT_QUEUED,
+    THROTTLE_EVENT_SATURATED,
+};
+
+static const char *throttle_event_names[] = {
+    [THROTTLE_EVENT_DRAINED] = "drained",
+    [THROTTLE_EVENT_QUEUED] = "queued",
+    [THROTTLE_EVENT_SATURATED] = "saturated",
+};
+
+static void bdrv_emit_throttle_event(BlockDriverState *bs, int state)
+{
+    QDict *data = qdict_new();
+
+    qdict_put(data, "device", qstring_from_str(bs->device_name));
+    qdict_put(data, "state", qstring_from_str(throttle_event_names[state]));
+    qdict_put(data, "queued", qint_from_int(bs->throttle_queued));
+    qdict_put(data, "rd_bytes", qint_from_int(bs->nr_bytes[BDRV_ACCT_READ] -
+                  bs->throttle_event_bytes[BDRV_ACCT_READ]));
+    qdict_put(data, "wr_bytes", qint_from_int(bs->nr_bytes[BDRV_ACCT_WRITE] -
+                  bs->throttle_event_bytes[BDRV_ACCT_WRITE]));
+    qdict_put(data, "rd_operations",
+              qint_from_int(bs->nr_ops[BDRV_ACCT_READ] -
+                            bs->throttle_event_ops[BDRV_ACCT_READ]));
+    qdict_put(data, "wr_operations",
+              qint_from_int(bs->nr_ops[BDRV_ACCT_WRITE] -
+                            bs->throttle_event_ops[BDRV_ACCT_WRITE]));
+    memcpy(bs->throttle_event_bytes, bs->nr_bytes, sizeof(bs->nr_bytes));
+    memcpy(bs->throttle_event_ops, bs->nr_ops, sizeof(bs->nr_ops));
+
+    monitor_protocol_event(QEVENT_BLOCK_IO_THROTTLE, QOBJECT(data));
+    QDECREF(data);
+}
+
+static void bdrv_throttle_event_update(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    int64_t interval = bs->throttle_event_interval;
+    int64_t now, next;
+    int state;
+
+    if (!interval) {
+        return;
+    }
+
+    now = qemu_get_clock_ns(rt_clock);
+    if (bs->throttle_queued == 0) {
+        state = THROTTLE_EVENT_DRAINED;
+    } else if (now - bs->throttle_busy_since >= interval) {
+        state = THROTTLE_EVENT_SATURATED;
+    } else {
+        state = THROTTLE_EVENT_QUEUED;
+    }
+
+    if (state == bs->throttle_event_state &&
+        state != THROTTLE_EVENT_SATURATED) {
+        if (state == THROTTLE_EVENT_QUEUED) {
+            /* come back to check for saturation */
+            qemu_mod_timer(bs->throttle_event_timer,
+                           bs->throttle_busy_since + interval);
+        }
+        return;
+    }
+
+    next = bs->throttle_event_last + interval;
+    if (now < next) {
+        qemu_mod_timer(bs->throttle_event_timer, next);
+        return;
+    }
+
+    bdrv_emit_throttle_event(bs, state);
+    bs->throttle_event_state = state;
+    bs->throttle_event_last = now;
+    if (state != THROTTLE_EVENT_DRAINED) {
+        qemu_mod_timer(bs->throttle_event_timer, now + interval);
+    }
+}
+
+/* Report throttle queue state changes of bs with BLOCK_IO_THROTTLE events,
+ * at most one per interval_ns.  An interval of 0 disables the events.
+ */
+void bdrv_set_io_throttle_events(BlockDriverState *bs, int64_t interval_ns)
+{
+    if (interval_ns && !bs->throttle_event_timer) {
+        bs->throttle_event_timer = qemu_new_timer_ns(rt_clock,
+                                                     bdrv_throttle_event_update,
+                                                     bs);
+        bs->throttle_event_state = THROTTLE_EVENT_DRAINED;
+        bs->throttle_event_last = 0;
+        memcpy(bs->throttle_event_bytes, bs->nr_bytes, sizeof(bs->nr_bytes));
+        memcpy(bs->throttle_event_ops, bs->nr_ops, sizeof(bs->nr_ops));
+    } else if (!interval_ns && bs->throttle_event_timer) {
+        qemu_del_timer(bs->throttle_event_timer);
+        qemu_free_timer(bs->throttle_event_timer);
+        bs->throttle_event_timer = NULL;
+    }
+    bs->throttle_event_interval = interval_ns;
+    bdrv_throttle_event_update(bs);
+}
+
+static void bdrv_throttle_queue_enter(BlockDriverState *bs, bool *queued)
+{
+    if (*queued) {
+        return;
+    }
+    *queued = true;
+    if (bs->throttle_queued++ == 0) {
+        bs->throttle_busy_since = qemu_get_clock_ns(rt_clock);
+        bdrv_throttle_event_update(bs);
+    }
+}
+
 static void bdrv_io_limits_intercept(BlockDriverState *bs,
                                      bool is_write, int nb_sectors)
 {
     int64_t wait_time = -1;
+    bool queued = false;
 
     if (!qemu_co_queue_empty(&bs->throttled_reqs)) {
+        bdrv_throttle_queue_enter(bs, &queued);
         qemu_co_queue_wait(&bs->throttled_reqs);
     }
 
@@ -179,9 +312,14 @@ static void bdrv_io_limits_intercept(BlockDriverState *bs,
     while (bdrv_exceed_io_limits(bs, nb_sectors, is_write, &wait_time)) {
         qemu_mod_timer(bs->block_timer,
                        wait_time + qemu_get_clock_ns(vm_clock));
+        bdrv_throttle_queue_enter(bs, &queued);
         qemu_co_queue_wait_insert_head(&bs->throttled_reqs);
     }
 
+    if (queued && --bs->throttle_queued == 0) {
+        bdrv_throttle_event_update(bs);
+    }
+
     qemu_co_queue_next(&bs->throttled_reqs);
 }
 
@@ -314,7 +452,12 @@ BlockDriverState *bdrv_new(const char *device_name, Error **errp)
     pstrcpy(bs->device_name, sizeof(bs->device_name), device_name);
     if (device_name[0] != '\0') {
         QTAILQ_INSERT_TAIL(&bdrv_states, bs, list);
+        if (!bdrv_names) {
+            bdrv_names = g_hash_table_new(g_str_hash, g_str_equal);
+        }
+        g_hash_table_insert(bdrv_names, bs->device_name, bs);
     }
+    QTAILQ_INIT(&bs->dirty_bitmaps);
     bdrv_iostatus_disable(bs);
     notifier_list_init(&bs->close_notifiers);
     bs->refcnt = 1;
@@ -1608,6 +1751,9 @@ void bdrv_close(BlockDriverState *bs)
             bdrv_unref(bs->file);
             bs->file = NULL;
         }
+
+        /* named bitmaps describe this medium, not the next one */
+        bdrv_release_named_dirty_bitmaps(bs);
     }
 
     bdrv_dev_change_media_cb(bs, false);
@@ -1671,6 +1817,7 @@ void bdrv_make_anon(BlockDriverState *bs)
 {
     if (bs->device_name[0] != '\0') {
         QTAILQ_REMOVE(&bdrv_states, bs, list);
+        g_hash_table_remove(bdrv_names, bs->device_name);
     }
     bs->device_name[0] = '\0';
 }
@@ -1706,6 +1853,14 @@ static void bdrv_move_feature_fields(BlockDriverState *bs_dest,
     bs_dest->block_timer        = bs_src->block_timer;
     bs_dest->io_limits_enabled  = bs_src->io_limits_enabled;
 
+    /* throttle queue events */
+    bs_dest->throttle_event_interval = bs_src->throttle_event_interval;
+    bs_dest->throttle_event_last     = bs_src->throttle_event_last;
+    bs_dest->throttle_busy_since     = bs_src->throttle_busy_since;
+    bs_dest->throttle_event_timer    = bs_src->throttle_event_timer;
+    bs_dest->throttle_queued         = bs_src->throttle_queued;
+    bs_dest->throttle_event_state    = bs_src->throttle_event_state;
+
     /* r/w error */
     bs_dest->on_read_error      = bs_src->on_read_error;
     bs_dest->on_write_error     = bs_src->on_write_error;
@@ -1714,8 +1869,9 @@ static void bdrv_move_feature_fields(BlockDriverState *bs_dest,
     bs_dest->iostatus_enabled   = bs_src->iostatus_enabled;
     bs_dest->iostatus           = bs_src->iostatus;
 
-    /* dirty bitmap */
-    bs_dest->dirty_bitmap       = bs_src->dirty_bitmap;
+    /* dirty bitmaps; bdrv_swap moves the head back into the BDS it
+       started in, so tqh_last and the first bitmap's tqe_prev stay valid */
+    bs_dest->dirty_bitmaps      = bs_src->dirty_bitmaps;
 
     /* reference count */
     bs_dest->refcnt             = bs_src->refcnt;
@@ -1748,7 +1904,7 @@ void bdrv_swap(BlockDriverState *bs_new, BlockDriverState *bs_old)
 
     /* bs_new must be anonymous and shouldn't have anything fancy enabled */
     assert(bs_new->device_name[0] == '\0');
-    assert(bs_new->dirty_bitmap == NULL);
+    assert(QTAILQ_EMPTY(&bs_new->dirty_bitmaps));
     assert(bs_new->job == NULL);
     assert(bs_new->dev == NULL);
     assert(bs_new->in_use == 0);
@@ -1814,6 +1970,12 @@ static void bdrv_delete(BlockDriverState *bs)
 
     /* remove from list, if necessary */
     bdrv_make_anon(bs);
+    bdrv_set_io_throttle_events(bs, 0);
+
+    /* named bitmaps went away in bdrv_close; free any job bitmaps left */
+    while (!QTAILQ_EMPTY(&bs->dirty_bitmaps)) {
+        bdrv_release_dirty_bitmap(bs, QTAILQ_FIRST(&bs->dirty_bitmaps));
+    }
 
     g_free(bs);
 }
@@ -3109,9 +3271,7 @@ static int coroutine_fn bdrv_aligned_pwritev(BlockDriverState *bs,
         ret = bdrv_co_flush(bs);
     }
 
-    if (bs->dirty_bitmap) {
-        bdrv_set_dirty(bs, sector_num, nb_sectors);
-    }
+    bdrv_set_dirty(bs, sector_num, nb_sectors);
 
     if (bs->wr_highest_sector < sector_num + nb_sectors - 1) {
         bs->wr_highest_sector = sector_num + nb_sectors - 1;
@@ -3388,6 +3548,9 @@ int bdrv_truncate(BlockDriverState *bs, int64_t offset)
         return -EACCES;
     if (bdrv_in_use(bs))
         return -EBUSY;
+    /* dirty bitmaps are not resized */
+    if (bdrv_has_named_dirty_bitmaps(bs))
+        return -EBUSY;
     ret = drv->bdrv_truncate(bs, offset);
     if (ret == 0) {
         ret = refresh_total_sectors(bs, offset >> BDRV_SECTOR_BITS);
@@ -3608,14 +3771,10 @@ void bdrv_iterate_format(void (*it)(void *opaque, const char *name),
 
 BlockDriverState *bdrv_find(const char *name)
 {
-    BlockDriverState *bs;
-
-    QTAILQ_FOREACH(bs, &bdrv_states, list) {
-        if (!strcmp(name, bs->device_name)) {
-            return bs;
-        }
+    if (!bdrv_names) {
+        return NULL;
     }
-    return NULL;
+    return g_hash_table_lookup(bdrv_names, name);
 }
 
 /* If 'base' is in the same chain as 'top', return true. Otherwise,
@@ -3967,7 +4126,7 @@ int bdrv_write_compressed(BlockDriverState *bs, int64_t sector_num,
     if (bdrv_check_request(bs, sector_num, nb_sectors))
         return -EIO;
 
-    assert(!bs->dirty_bitmap);
+    assert(QTAILQ_EMPTY(&bs->dirty_bitmaps));
 
     return drv->bdrv_write_compressed(bs, sector_num, buf, nb_sectors);
 }
@@ -5031,9 +5190,7 @@ int coroutine_fn bdrv_co_discard(BlockDriverState *bs, int64_t sector_num,
         return -EROFS;
     }
 
-    if (bs->dirty_bitmap) {
-        bdrv_reset_dirty(bs, sector_num, nb_sectors);
-    }
+    bdrv_reset_dirty(bs, sector_num, nb_sectors);
 
     /* Do nothing if disabled.  */
     if (!(bs->open_flags & BDRV_O_UNMAP)) {
@@ -5258,55 +5415,177 @@ bool bdrv_qiov_is_aligned(BlockDriverState *bs, QEMUIOVector *qiov)
     return true;
 }
 
-void bdrv_set_dirty_tracking(BlockDriverState *bs, int granularity)
+struct BdrvDirtyBitmap {
+    HBitmap *bitmap;
+    char *name;
+    QTAILQ_ENTRY(BdrvDirtyBitmap) list;
+};
+
+/* Bitmaps without a name belong to block jobs and block migration;
+ * named ones are created and released through QMP.
+ */
+BdrvDirtyBitmap *bdrv_create_dirty_bitmap(BlockDriverState *bs,
+                                          int granularity,
+                                          const char *name,
+                                          Error **errp)
 {
     int64_t bitmap_size;
+    BdrvDirtyBitmap *bitmap;
 
     assert((granularity & (granularity - 1)) == 0);
 
-    if (granularity) {
-        granularity >>= BDRV_SECTOR_BITS;
-        assert(!bs->dirty_bitmap);
-        bitmap_size = (bdrv_getlength(bs) >> BDRV_SECTOR_BITS);
-        bs->dirty_bitmap = hbitmap_alloc(bitmap_size, ffs(granularity) - 1);
-    } else {
-        if (bs->dirty_bitmap) {
-            hbitmap_free(bs->dirty_bitmap);
-            bs->dirty_bitmap = NULL;
+    if (name && bdrv_find_dirty_bitmap(bs, name)) {
+        error_setg(errp, "Bitmap already exists: %s", name);
+        return NULL;
+    }
+    granularity >>= BDRV_SECTOR_BITS;
+    assert(granularity);
+    bitmap_size = bdrv_getlength(bs);
+    if (bitmap_size < 0) {
+        error_setg_errno(errp, -bitmap_size, "could not get length of device");
+        return NULL;
+    }
+    bitmap_size >>= BDRV_SECTOR_BITS;
+    bitmap = g_malloc0(sizeof(BdrvDirtyBitmap));
+    bitmap->bitmap = hbitmap_alloc(bitmap_size, ffs(granularity) - 1);
+    bitmap->name = g_strdup(name);
+
+    /* keep creation order, so that query-block lists the oldest first */
+    QTAILQ_INSERT_TAIL(&bs->dirty_bitmaps, bitmap, list);
+    return bitmap;
+}
+
+BdrvDirtyBitmap *bdrv_find_dirty_bitmap(BlockDriverState *bs,
+                                        const char *name)
+{
+    BdrvDirtyBitmap *bm;
+
+    QTAILQ_FOREACH(bm, &bs->dirty_bitmaps, list) {
+        if (bm->name && !strcmp(name, bm->name)) {
+            return bm;
+        }
+    }
+    return NULL;
+}
+
+void bdrv_release_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap)
+{
+    QTAILQ_REMOVE(&bs->dirty_bitmaps, bitmap, list);
+    hbitmap_free(bitmap->bitmap);
+    g_free(bitmap->name);
+    g_free(bitmap);
+}
+
+static bool bdrv_has_named_dirty_bitmaps(BlockDriverState *bs)
+{
+    BdrvDirtyBitmap *bm;
+
+    QTAILQ_FOREACH(bm, &bs->dirty_bitmaps, list) {
+        if (bm->name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void bdrv_release_named_dirty_bitmaps(BlockDriverState *bs)
+{
+    BdrvDirtyBitmap *bm, *next;
+
+    QTAILQ_FOREACH_SAFE(bm, &bs->dirty_bitmaps, list, next) {
+        if (bm->name) {
+            bdrv_release_dirty_bitmap(bs, bm);
         }
     }
 }
 
-int bdrv_get_dirty(BlockDriverState *bs, int64_t sector)
+void bdrv_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap)
+{
+    hbitmap_reset_all(bitmap->bitmap);
+}
+
+BlockDirtyInfoList *bdrv_query_dirty_bitmaps(BlockDriverState *bs)
+{
+    BdrvDirtyBitmap *bm;
+    BlockDirtyInfoList *list = NULL;
+    BlockDirtyInfoList **plist = &list;
+
+    QTAILQ_FOREACH(bm, &bs->dirty_bitmaps, list) {
+        BlockDirtyInfo *info = g_malloc0(sizeof(BlockDirtyInfo));
+        BlockDirtyInfoList *entry = g_malloc0(sizeof(BlockDirtyInfoList));
+        info->count = bdrv_get_dirty_count(bs, bm) * BDRV_SECTOR_SIZE;
+        info->granularity =
+            ((int64_t) BDRV_SECTOR_SIZE << hbitmap_granularity(bm->bitmap));
+        info->has_name = !!bm->name;
+        info->name = g_strdup(bm->name);
+        entry->value = info;
+        *plist = entry;
+        plist = &entry->next;
+    }
+
+    return list;
+}
+
+int bdrv_get_dirty(BlockDriverState *bs, BdrvDirtyBitmap *bitmap,
+                   int64_t sector)
 {
-    if (bs->dirty_bitmap) {
-        return hbitmap_get(bs->dirty_bitmap, sector);
+    if (bitmap) {
+        return hbitmap_get(bitmap->bitmap, sector);
     } else {
         return 0;
     }
 }
 
-void bdrv_dirty_iter_init(BlockDriverState *bs, HBitmapIter *hbi)
+void bdrv_dirty_iter_init(BlockDriverState *bs,
+                          BdrvDirtyBitmap *bitmap, HBitmapIter *hbi)
 {
-    hbitmap_iter_init(hbi, bs->dirty_bitmap, 0);
+    hbitmap_iter_init(hbi, bitmap->bitmap, 0);
 }
 
-void bdrv_set_dirty(BlockDriverState *bs, int64_t cur_sector,
-                    int nr_sectors)
+void bdrv_set_dirty_bitmap(BdrvDirtyBitmap *bitmap, int64_t cur_sector,
+                           int nr_sectors)
 {
-    hbitmap_set(bs->dirty_bitmap, cur_sector, nr_sectors);
+    hbitmap_set(bitmap->bitmap, cur_sector, nr_sectors);
 }
 
-void bdrv_reset_dirty(BlockDriverState *bs, int64_t cur_sector,
-                      int nr_sectors)
+void bdrv_reset_dirty_bitmap(BdrvDirtyBitmap *bitmap, int64_t cur_sector,
+                             int nr_sectors)
 {
-    hbitmap_reset(bs->dirty_bitmap, cur_sector, nr_sectors);
+    hbitmap_reset(bitmap->bitmap, cur_sector, nr_sectors);
+}
+
+/* Every write is recorded in all bitmaps of the drive.  */
+static void bdrv_set_dirty(BlockDriverState *bs, int64_t cur_sector,
+                           int nr_sectors)
+{
+    BdrvDirtyBitmap *bitmap;
+
+    QTAILQ_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+        hbitmap_set(bitmap->bitmap, cur_sector, nr_sectors);
+    }
+}
+
+/* Discarded sectors need not be copied by jobs, but a named bitmap must
+ * still see them as changed since it was last cleared.
+ */
+static void bdrv_reset_dirty(BlockDriverState *bs, int64_t cur_sector,
+                             int nr_sectors)
+{
+    BdrvDirtyBitmap *bitmap;
+
+    QTAILQ_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+        if (bitmap->name) {
+            hbitmap_set(bitmap->bitmap, cur_sector, nr_sectors);
+        } else {
+            hbitmap_reset(bitmap->bitmap, cur_sector, nr_sectors);
+        }
+    }
 }
 
-int64_t bdrv_get_dirty_count(BlockDriverState *bs)
+int64_t bdrv_get_dirty_count(BlockDriverState *bs, BdrvDirtyBitmap *bitmap)
 {
-    if (bs->dirty_bitmap) {
-        return hbitmap_count(bs->dirty_bitmap);
+    if (bitmap) {
+        return hbitmap_count(bitmap->bitmap);
     } else {
         return 0;
     }
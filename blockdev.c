@@ -1289,6 +1289,21 @@ void qmp_change_blockdev(const char *device, const char *filename,
 }
 
 /* throttling disk I/O limits */
+static void set_io_limits(BlockDriverState *bs, BlockIOLimit *io_limits)
+{
+    bs->io_limits = *io_limits;
+
+    if (!bs->io_limits_enabled && bdrv_io_limits_enabled(bs)) {
+        bdrv_io_limits_enable(bs);
+    } else if (bs->io_limits_enabled && !bdrv_io_limits_enabled(bs)) {
+        bdrv_io_limits_disable(bs);
+    } else {
+        if (bs->block_timer) {
+            qemu_mod_timer(bs->block_timer, qemu_get_clock_ns(vm_clock));
+        }
+    }
+}
+
 void qmp_block_set_io_throttle(const char *device, int64_t bps, int64_t bps_rd,
                                int64_t bps_wr, int64_t iops, int64_t iops_rd,
                                int64_t iops_wr, Error **errp)
@@ -1313,17 +1328,168 @@ void qmp_block_set_io_throttle(const char *device, int64_t bps, int64_t bps_rd,
         return;
     }
 
-    bs->io_limits = io_limits;
+    set_io_limits(bs, &io_limits);
+}
 
-    if (!bs->io_limits_enabled && bdrv_io_limits_enabled(bs)) {
-        bdrv_io_limits_enable(bs);
-    } else if (bs->io_limits_enabled && !bdrv_io_limits_enabled(bs)) {
-        bdrv_io_limits_disable(bs);
-    } else {
-        if (bs->block_timer) {
-            qemu_mod_timer(bs->block_timer, qemu_get_clock_ns(vm_clock));
+/* one day, in milliseconds */
+#define THROTTLE_EVENT_INTERVAL_MAX (24 * 60 * 60 * 1000LL)
+
+void qmp_block_set_io_throttle_events(const char *device, int64_t interval,
+                                      Error **errp)
+{
+    BlockDriverState *bs;
+
+    bs = bdrv_find(device);
+    if (!bs) {
+        error_set(errp, QERR_DEVICE_NOT_FOUND, device);
+        return;
+    }
+    /* bounded so that the interval in ns, added to the clock, fits in
+       an int64_t */
+    if (interval < 0 || interval > THROTTLE_EVENT_INTERVAL_MAX) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "interval",
+                  "a number of milliseconds between 0 and 86400000");
+        return;
+    }
+
+    bdrv_set_io_throttle_events(bs, interval * SCALE_MS);
+}
+
+static BdrvDirtyBitmap *find_dirty_bitmap(const char *device,
+                                          const char *name,
+                                          BlockDriverState **pbs,
+                                          Error **errp)
+{
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+
+    bs = bdrv_find(device);
+    if (!bs) {
+        error_set(errp, QERR_DEVICE_NOT_FOUND, device);
+        return NULL;
+    }
+    bitmap = bdrv_find_dirty_bitmap(bs, name);
+    if (!bitmap) {
+        error_setg(errp, "Dirty bitmap '%s' not found on device '%s'",
+                   name, device);
+        return NULL;
+    }
+    *pbs = bs;
+    return bitmap;
+}
+
+void qmp_block_dirty_bitmap_add(const char *device, const char *name,
+                                bool has_granularity, uint32_t granularity,
+                                Error **errp)
+{
+    BlockDriverState *bs;
+
+    bs = bdrv_find(device);
+    if (!bs) {
+        error_set(errp, QERR_DEVICE_NOT_FOUND, device);
+        return;
+    }
+    if (!bdrv_is_inserted(bs)) {
+        error_set(errp, QERR_DEVICE_HAS_NO_MEDIUM, device);
+        return;
+    }
+
+    if (!has_granularity) {
+        granularity = 65536;
+    }
+    if (granularity < 512 || granularity > 1048576 * 64 ||
+        (granularity & (granularity - 1))) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "granularity",
+                  "a power of two between 512 and 64M");
+        return;
+    }
+
+    bdrv_create_dirty_bitmap(bs, granularity, name, errp);
+}
+
+void qmp_block_dirty_bitmap_remove(const char *device, const char *name,
+                                   Error **errp)
+{
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+
+    bitmap = find_dirty_bitmap(device, name, &bs, errp);
+    if (bitmap) {
+        bdrv_release_dirty_bitmap(bs, bitmap);
+    }
+}
+
+void qmp_block_dirty_bitmap_clear(const char *device, const char *name,
+                                  Error **errp)
+{
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+
+    bitmap = find_dirty_bitmap(device, name, &bs, errp);
+    if (bitmap) {
+        bdrv_clear_dirty_bitmap(bitmap);
+    }
+}
+
+typedef struct IOThrottleUpdate {
+    BlockDriverState *bs;
+    BlockIOLimit io_limits;
+} IOThrottleUpdate;
+
+/* Apply several sets of limits at once.  Everything is validated before
+   the first device is touched, so the new limits take effect together or
+   not at all.  */
+void qmp_block_set_io_throttle_batch(BlockIOThrottleList *limits,
+                                     Error **errp)
+{
+    BlockIOThrottleList *entry;
+    IOThrottleUpdate *updates;
+    Error *local_err = NULL;
+    int i, j, n = 0;
+
+    for (entry = limits; entry; entry = entry->next) {
+        n++;
+    }
+    updates = g_new0(IOThrottleUpdate, n);
+
+    for (entry = limits, i = 0; entry; entry = entry->next, i++) {
+        BlockIOThrottle *t = entry->value;
+        BlockIOLimit *io_limits = &updates[i].io_limits;
+
+        updates[i].bs = bdrv_find(t->device);
+        if (!updates[i].bs) {
+            error_set(errp, QERR_DEVICE_NOT_FOUND, t->device);
+            goto out;
+        }
+        for (j = 0; j < i; j++) {
+            if (updates[j].bs == updates[i].bs) {
+                error_setg(errp, "Device '%s' is listed more than once",
+                           t->device);
+                goto out;
+            }
+        }
+
+        io_limits->bps[BLOCK_IO_LIMIT_TOTAL] = t->bps;
+        io_limits->bps[BLOCK_IO_LIMIT_READ]  = t->bps_rd;
+        io_limits->bps[BLOCK_IO_LIMIT_WRITE] = t->bps_wr;
+        io_limits->iops[BLOCK_IO_LIMIT_TOTAL] = t->iops;
+        io_limits->iops[BLOCK_IO_LIMIT_READ]  = t->iops_rd;
+        io_limits->iops[BLOCK_IO_LIMIT_WRITE] = t->iops_wr;
+
+        if (!do_check_io_limits(io_limits, &local_err)) {
+            error_setg(errp, "Device '%s': %s", t->device,
+                       error_get_pretty(local_err));
+            error_free(local_err);
+            goto out;
         }
     }
+
+    for (i = 0; i < n; i++) {
+        set_io_limits(updates[i].bs, &updates[i].io_limits);
+    }
+
+out:
+    g_free(updates);
 }
 
 int do_drive_del(Monitor *mon, const QDict *qdict, QObject **ret_data)
@@ -104,8 +104,6 @@ static TranslationBlock *tb_find_slow(CPUArchState *env,
     tb_page_addr_t phys_pc, phys_page1;
     target_ulong virt_page2;
 
-    tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
-
     /* find translated block using physical mappings */
     phys_pc = get_page_addr_code(env, pc);
     phys_page1 = phys_pc & TARGET_PAGE_MASK;
@@ -150,21 +148,42 @@ static TranslationBlock *tb_find_slow(CPUArchState *env,
     return tb;
 }
 
-static inline TranslationBlock *tb_find_fast(CPUArchState *env)
+/* Return the TB for the current CPU state, and in *gen the value of
+   tb_invalidated_gen at which it was known to be valid.  */
+static inline TranslationBlock *tb_find_fast(CPUArchState *env,
+                                             unsigned int *gen)
 {
     TranslationBlock *tb;
     target_ulong cs_base, pc;
     int flags;
+    unsigned int start_gen;
 
     /* we record a subset of the CPU state. It will
        always be the same before a given translated block
        is executed. */
     cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
-    tb = env->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
-    if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
-                 tb->flags != flags)) {
-        tb = tb_find_slow(env, pc, cs_base, flags);
+    /* The jump cache is per CPU and only this thread fills it, but other
+       threads clear entries and may evict a TB and reuse its slot for new
+       code while we look at it.  Eviction clears the jump caches first and
+       then bumps tb_invalidated_gen, before the slot is rewritten, so a
+       hit is only trusted if the generation did not move meanwhile.  */
+    start_gen = atomic_read(&tcg_ctx.tb_ctx.tb_invalidated_gen);
+    smp_rmb();
+    tb = atomic_read(&env->tb_jmp_cache[tb_jmp_cache_hash_func(pc)]);
+    if (likely(tb && tb->pc == pc && tb->cs_base == cs_base &&
+               tb->flags == flags && !tb->invalid)) {
+        smp_rmb();
+        if (likely(atomic_read(&tcg_ctx.tb_ctx.tb_invalidated_gen) ==
+                   start_gen)) {
+            *gen = start_gen;
+            return tb;
+        }
     }
+
+    spin_lock(&tcg_ctx.tb_ctx.tb_lock);
+    tb = tb_find_slow(env, pc, cs_base, flags);
+    *gen = tcg_ctx.tb_ctx.tb_invalidated_gen;
+    spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
     return tb;
 }
 
@@ -204,6 +223,7 @@ int cpu_exec(CPUArchState *env)
     TranslationBlock *tb;
     uint8_t *tc_ptr;
     tcg_target_ulong next_tb;
+    unsigned int tb_gen, last_tb_gen = 0;
 
     if (cpu->halted) {
         if (!cpu_has_work(cpu)) {
@@ -589,17 +609,10 @@ int cpu_exec(CPUArchState *env)
 #endif
                 }
 #endif /* DEBUG_DISAS */
-                spin_lock(&tcg_ctx.tb_ctx.tb_lock);
-                tb = tb_find_fast(env);
-                /* Note: we do it here to avoid a gcc bug on Mac OS X when
-                   doing it in tb_find_slow */
-                if (tcg_ctx.tb_ctx.tb_invalidated_flag) {
-                    /* as some TB could have been invalidated because
-                       of memory exceptions while generating the code, we
-                       must recompute the hash index here */
-                    next_tb = 0;
-                    tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
-                }
+                tb = tb_find_fast(env, &tb_gen);
+#ifdef CONFIG_PROFILER
+                tb->exec_count++;
+#endif
                 if (qemu_loglevel_mask(CPU_LOG_EXEC)) {
                     qemu_log("Trace %p [" TARGET_FMT_lx "] %s\n",
                              tb->tc_ptr, tb->pc, lookup_symbol(tb->pc));
@@ -608,10 +621,18 @@ int cpu_exec(CPUArchState *env)
                    spans two pages, we cannot safely do a direct
                    jump. */
                 if (next_tb != 0 && tb->page_addr[1] == -1) {
-                    tb_add_jump((TranslationBlock *)(next_tb & ~TB_EXIT_MASK),
-                                next_tb & TB_EXIT_MASK, tb);
+                    spin_lock(&tcg_ctx.tb_ctx.tb_lock);
+                    /* some TB could have been invalidated, by this or
+                       another thread, since the calling TB was looked up;
+                       it may even have been reused for other code */
+                    if (tcg_ctx.tb_ctx.tb_invalidated_gen == last_tb_gen) {
+                        tb_add_jump((TranslationBlock *)
+                                    (next_tb & ~TB_EXIT_MASK),
+                                    next_tb & TB_EXIT_MASK, tb);
+                    }
+                    spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
                 }
-                spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
+                last_tb_gen = tb_gen;
 
                 /* cpu_interrupt might be called while translating the
                    TB, but before it is linked into a potentially
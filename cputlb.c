@@ -33,6 +33,8 @@
 
 /* statistics */
 int tlb_flush_count;
+int tlb_fill_count;
+int tlb_victim_hit_count;
 
 static const CPUTLBEntry s_cputlb_empty_entry = {
     .addr_read  = -1,
@@ -72,6 +74,14 @@ void tlb_flush(CPUArchState *env, int flush_global)
             env->tlb_table[mmu_idx][i] = s_cputlb_empty_entry;
         }
     }
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        int mmu_idx;
+
+        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            env->tlb_v_table[mmu_idx][i] = s_cputlb_empty_entry;
+        }
+    }
+    env->vtlb_index = 0;
 
     memset(env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof (void *));
 
@@ -121,6 +131,15 @@ void tlb_flush_page(CPUArchState *env, target_ulong addr)
         tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
     }
 
+    /* check whether there are entries that need to be flushed in the vtlb */
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        int k;
+
+        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+            tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], addr);
+        }
+    }
+
     tb_flush_jmp_cache(env, addr);
 }
 
@@ -187,6 +206,11 @@ void cpu_tlb_reset_dirty_all(ram_addr_t start1, ram_addr_t length)
                 tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                       start1, length);
             }
+
+            for (i = 0; i < CPU_VTLB_SIZE; i++) {
+                tlb_reset_dirty_range(&env->tlb_v_table[mmu_idx][i],
+                                      start1, length);
+            }
         }
     }
 }
@@ -210,6 +234,14 @@ void tlb_set_dirty(CPUArchState *env, target_ulong vaddr)
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
     }
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        int k;
+
+        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+            tlb_set_dirty1(&env->tlb_v_table[mmu_idx][k], vaddr);
+        }
+    }
 }
 
 /* Our TLB does not support large pages, so remember the area covered by
@@ -235,6 +267,51 @@ static void tlb_add_large_page(CPUArchState *env, target_ulong vaddr,
     env->tlb_flush_mask = mask;
 }
 
+static bool tlb_entry_is_empty(CPUTLBEntry *tlb_entry)
+{
+    return tlb_entry->addr_read == -1 && tlb_entry->addr_write == -1 &&
+        tlb_entry->addr_code == -1;
+}
+
+static bool tlb_entry_is_page(CPUTLBEntry *tlb_entry, target_ulong page)
+{
+    target_ulong mask = TARGET_PAGE_MASK | TLB_INVALID_MASK;
+
+    return page == (tlb_entry->addr_read & mask) ||
+        page == (tlb_entry->addr_write & mask) ||
+        page == (tlb_entry->addr_code & mask);
+}
+
+/* Look for 'page' in the victim TLB.  elt_ofs selects the addr_read,
+   addr_write or addr_code field to match.  On a hit, the entry is swapped
+   with the direct mapped entry at 'index' so that the fast path finds it
+   next time.  */
+bool tlb_victim_hit(CPUArchState *env, int mmu_idx, int index,
+                    size_t elt_ofs, target_ulong page)
+{
+    int vidx;
+
+    for (vidx = 0; vidx < CPU_VTLB_SIZE; vidx++) {
+        CPUTLBEntry *vtlb = &env->tlb_v_table[mmu_idx][vidx];
+        target_ulong cmp = *(target_ulong *)((uintptr_t)vtlb + elt_ofs);
+
+        if (page == (cmp & (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
+            CPUTLBEntry tmptlb, *tlb = &env->tlb_table[mmu_idx][index];
+            hwaddr tmpio, *io = &env->iotlb[mmu_idx][index];
+
+            tmptlb = *tlb;
+            *tlb = *vtlb;
+            *vtlb = tmptlb;
+            tmpio = *io;
+            *io = env->iotlb_v[mmu_idx][vidx];
+            env->iotlb_v[mmu_idx][vidx] = tmpio;
+            tlb_victim_hit_count++;
+            return true;
+        }
+    }
+    return false;
+}
+
 /* Add a new TLB entry. At most one entry for a given virtual address
    is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
    supplied size is only used by tlb_flush_page.  */
@@ -251,6 +328,7 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
     hwaddr iotlb;
 
     assert(size >= TARGET_PAGE_SIZE);
+    tlb_fill_count++;
     if (size != TARGET_PAGE_SIZE) {
         tlb_add_large_page(env, vaddr, size);
     }
@@ -280,8 +358,19 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
                                             &address);
 
     index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    env->iotlb[mmu_idx][index] = iotlb - vaddr;
     te = &env->tlb_table[mmu_idx][index];
+
+    /* keep the conflicting entry in the victim tlb, unless it maps the
+       page being replaced */
+    if (!tlb_entry_is_empty(te) &&
+        !tlb_entry_is_page(te, vaddr & TARGET_PAGE_MASK)) {
+        unsigned int vidx = env->vtlb_index++ % CPU_VTLB_SIZE;
+
+        env->tlb_v_table[mmu_idx][vidx] = *te;
+        env->iotlb_v[mmu_idx][vidx] = env->iotlb[mmu_idx][index];
+    }
+
+    env->iotlb[mmu_idx][index] = iotlb - vaddr;
     te->addend = addend - vaddr;
     if (prot & PAGE_READ) {
         te->addr_read = address;
@@ -329,19 +329,32 @@ ETEXI
 
     {
         .name       = "savevm",
-        .args_type  = "name:s?",
-        .params     = "[tag|id]",
-        .help       = "save a VM snapshot. If no tag or id are provided, a new snapshot is created",
+        .args_type  = "live:-l,name:s?",
+        .params     = "[-l] [tag|id]",
+        .help       = "save a VM snapshot. If no tag or id are provided, a new snapshot is created"
+                      "\n\t\t\t -l to save RAM while the guest keeps running; until it"
+                      "\n\t\t\t completes, migrate, loadvm, and drive_del, eject, change"
+                      "\n\t\t\t or block_resize on the snapshot drive are refused",
         .mhandler.cmd = do_savevm,
     },
 
 STEXI
-@item savevm [@var{tag}|@var{id}]
+@item savevm [-l] [@var{tag}|@var{id}]
 @findex savevm
 Create a snapshot of the whole virtual machine. If @var{tag} is
 provided, it is used as human readable identifier. If there is already
 a snapshot with the same tag or ID, it is replaced. More info at
 @ref{vm_snapshots}.
+
+With @option{-l}, the command returns immediately and guest RAM is
+written to the image in the background while the guest keeps running,
+the same way live migration copies it.  The guest is stopped only once
+the remaining dirty memory can be written within the maximum downtime
+(see @code{migrate_set_downtime}); device state and the disk snapshots
+are then taken at that point.  Until the snapshot is complete,
+@code{migrate} and @code{loadvm} are refused, and so are
+@code{drive_del}, @code{eject}, @code{change} and @code{block_resize}
+on the drive that receives the VM state.
 ETEXI
 
     {
@@ -34,11 +34,12 @@
 #define PCI_VGA_IOPORT_OFFSET 0x400
 #define PCI_VGA_IOPORT_SIZE   (0x3e0 - 0x3c0)
 #define PCI_VGA_BOCHS_OFFSET  0x500
-#define PCI_VGA_BOCHS_SIZE    (0x0b * 2)
+#define PCI_VGA_BOCHS_SIZE    (0x10 * 2)
 #define PCI_VGA_MMIO_SIZE     0x1000
 
 enum vga_pci_flags {
     PCI_VGA_FLAG_ENABLE_MMIO = 1,
+    PCI_VGA_FLAG_ENABLE_DAMAGE = 2,
 };
 
 typedef struct PCIVGAState {
@@ -147,6 +148,7 @@ static int pci_std_vga_initfn(PCIDevice *dev)
     VGACommonState *s = &d->vga;
 
     /* vga + console init */
+    s->damage_supported = d->flags & (1 << PCI_VGA_FLAG_ENABLE_DAMAGE);
     vga_common_init(s);
     vga_init(s, pci_address_space(dev), pci_address_space_io(dev), true);
 
@@ -181,6 +183,8 @@ static int pci_std_vga_initfn(PCIDevice *dev)
 static Property vga_pci_properties[] = {
     DEFINE_PROP_UINT32("vgamem_mb", PCIVGAState, vga.vram_size_mb, 16),
     DEFINE_PROP_BIT("mmio", PCIVGAState, flags, PCI_VGA_FLAG_ENABLE_MMIO, true),
+    DEFINE_PROP_BIT("damage", PCIVGAState, flags,
+                    PCI_VGA_FLAG_ENABLE_DAMAGE, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
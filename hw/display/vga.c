@@ -724,6 +724,107 @@ static void vbe_update_vgaregs(VGACommonState *s)
     s->cr[VGA_CRTC_MAX_SCAN] &= ~0x9f; /* no double scan */
 }
 
+static bool vga_damage_active(VGACommonState *s)
+{
+    return s->damage_supported &&
+        (s->damage_ctrl & VBE_DISPI_DAMAGE_ENABLED) && vbe_enabled(s);
+}
+
+/* Dirty logging of the vram is only needed while the guest does not
+ * report damage itself.  When it is turned back on the dirty bitmap is
+ * stale, so force a full redraw. */
+static void vga_damage_update_log(VGACommonState *s)
+{
+    bool active = vga_damage_active(s);
+
+    if (active == s->damage_log_off) {
+        return;
+    }
+    if (active) {
+        vga_dirty_log_stop(s);
+    } else {
+        vga_dirty_log_start(s);
+        s->graphic_mode = -1;
+    }
+    s->damage_log_off = active;
+    s->damage_count = 0;
+}
+
+static void vga_damage_add(VGACommonState *s, const VGADamageRect *r)
+{
+    VGADamageRect *last;
+    int x1, y1, x2, y2;
+
+    if (r->w == 0 || r->h == 0) {
+        return;
+    }
+    if (s->damage_count < VGA_MAX_DAMAGE) {
+        s->damage[s->damage_count++] = *r;
+        return;
+    }
+    /* queue full: grow the last rectangle to cover the new one */
+    last = &s->damage[VGA_MAX_DAMAGE - 1];
+    x1 = MIN(last->x, r->x);
+    y1 = MIN(last->y, r->y);
+    x2 = MAX(last->x + last->w, r->x + r->w);
+    y2 = MAX(last->y + last->h, r->y + r->h);
+    last->x = x1;
+    last->y = y1;
+    last->w = MIN(x2 - x1, 0xffff);
+    last->h = MIN(y2 - y1, 0xffff);
+}
+
+static uint32_t vbe_damage_read(VGACommonState *s, int index)
+{
+    if (!s->damage_supported) {
+        return 0;
+    }
+    switch (index) {
+    case VBE_DISPI_INDEX_DAMAGE_CTRL:
+        return s->damage_ctrl;
+    case VBE_DISPI_INDEX_DAMAGE_X:
+        return s->damage_cur.x;
+    case VBE_DISPI_INDEX_DAMAGE_Y:
+        return s->damage_cur.y;
+    case VBE_DISPI_INDEX_DAMAGE_W:
+        return s->damage_cur.w;
+    case VBE_DISPI_INDEX_DAMAGE_H:
+        return s->damage_cur.h;
+    default:
+        return 0;
+    }
+}
+
+static void vbe_damage_write(VGACommonState *s, int index, uint32_t val)
+{
+    if (!s->damage_supported) {
+        return;
+    }
+    switch (index) {
+    case VBE_DISPI_INDEX_DAMAGE_CTRL:
+        s->damage_ctrl = val & VBE_DISPI_DAMAGE_ENABLED;
+        vga_damage_update_log(s);
+        break;
+    case VBE_DISPI_INDEX_DAMAGE_X:
+        s->damage_cur.x = val;
+        break;
+    case VBE_DISPI_INDEX_DAMAGE_Y:
+        s->damage_cur.y = val;
+        break;
+    case VBE_DISPI_INDEX_DAMAGE_W:
+        s->damage_cur.w = val;
+        break;
+    case VBE_DISPI_INDEX_DAMAGE_H:
+        s->damage_cur.h = val;
+        if (s->damage_log_off) {
+            vga_damage_add(s, &s->damage_cur);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
 static uint32_t vbe_ioport_read_index(void *opaque, uint32_t addr)
 {
     VGACommonState *s = opaque;
@@ -759,6 +860,9 @@ uint32_t vbe_ioport_read_data(void *opaque, uint32_t addr)
         }
     } else if (s->vbe_index == VBE_DISPI_INDEX_VIDEO_MEMORY_64K) {
         val = s->vbe_size / (64 * 1024);
+    } else if (s->vbe_index >= VBE_DISPI_INDEX_DAMAGE_CTRL &&
+               s->vbe_index <= VBE_DISPI_INDEX_DAMAGE_H) {
+        val = vbe_damage_read(s, s->vbe_index);
     } else {
         val = 0;
     }
@@ -830,10 +934,14 @@ void vbe_ioport_write_data(void *opaque, uint32_t addr, uint32_t val)
             s->dac_8bit = (val & VBE_DISPI_8BIT_DAC) > 0;
             s->vbe_regs[s->vbe_index] = val;
             vga_update_memory_access(s);
+            vga_damage_update_log(s);
             break;
         default:
             break;
         }
+    } else if (s->vbe_index >= VBE_DISPI_INDEX_DAMAGE_CTRL &&
+               s->vbe_index <= VBE_DISPI_INDEX_DAMAGE_H) {
+        vbe_damage_write(s, s->vbe_index, val);
     }
 }
 
@@ -1503,6 +1611,37 @@ void vga_dirty_log_stop(VGACommonState *s)
 /*
  * graphic modes
  */
+
+/* redraw only what the guest reported; vbe modes have a linear layout */
+static void vga_draw_damage(VGACommonState *s, DisplaySurface *surface,
+                            vga_draw_line_func *vga_draw_line,
+                            int width, int height)
+{
+    VGADamageRect *r;
+    uint8_t *d = surface_data(surface);
+    int linesize = surface_stride(surface);
+    int i, x, y, w, h, yy;
+
+    for (i = 0; i < s->damage_count; i++) {
+        r = &s->damage[i];
+        x = MIN(r->x, width);
+        y = MIN(r->y, height);
+        w = MIN(r->w, width - x);
+        h = MIN(r->h, height - y);
+        if (w == 0 || h == 0) {
+            continue;
+        }
+        if (!is_buffer_shared(surface)) {
+            for (yy = y; yy < y + h; yy++) {
+                vga_draw_line(s, d + yy * linesize,
+                              s->start_addr * 4 + yy * s->line_offset, width);
+            }
+        }
+        dpy_gfx_update(s->con, x, y, w, h);
+    }
+    s->damage_count = 0;
+}
+
 static void vga_draw_graphic(VGACommonState *s, int full_update)
 {
     DisplaySurface *surface = qemu_console_surface(s->con);
@@ -1514,6 +1653,7 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
     uint32_t v, addr1, addr;
     vga_draw_line_func *vga_draw_line;
     bool share_surface, force_shadow = false;
+    bool damage = s->damage_log_off;
 #if defined(TARGET_WORDS_BIGENDIAN)
     static const bool big_endian_fb = true;
 #else
@@ -1527,7 +1667,7 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
 
     full_update |= update_basic_params(s);
 
-    if (!full_update)
+    if (!full_update && !damage)
         vga_sync_dirty_bitmap(s);
 
     s->get_resolution(s, &width, &height);
@@ -1669,6 +1809,14 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
         s->cursor_invalidate(s);
     }
 
+    if (damage) {
+        if (!full_update) {
+            vga_draw_damage(s, surface, vga_draw_line, disp_width, height);
+            return;
+        }
+        s->damage_count = 0;
+    }
+
 #if 0
     printf("w=%d h=%d v=%d line_offset=%d cr[0x09]=0x%02x cr[0x17]=0x%02x linecmp=%d sr[0x01]=0x%02x\n",
            width, height, v, line_offset, s->cr[9], s->cr[VGA_CRTC_MODE],
@@ -1864,6 +2012,8 @@ void vga_common_reset(VGACommonState *s)
     s->vbe_start_addr = 0;
     s->vbe_line_offset = 0;
     s->vbe_bank_mask = (s->vram_size >> 16) - 1;
+    s->damage_ctrl = 0;
+    vga_damage_update_log(s);
     memset(s->font_offsets, '\0', sizeof(s->font_offsets));
     s->graphic_mode = -1; /* force full update */
     s->shift_control = 0;
@@ -2110,9 +2260,28 @@ static int vga_common_post_load(void *opaque, int version_id)
     /* force refresh */
     s->graphic_mode = -1;
     vbe_update_vgaregs(s);
+    vga_damage_update_log(s);
     return 0;
 }
 
+static bool vga_damage_needed(void *opaque)
+{
+    VGACommonState *s = opaque;
+
+    return s->damage_ctrl != 0;
+}
+
+static const VMStateDescription vmstate_vga_damage = {
+    .name = "vga/damage",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields      = (VMStateField []) {
+        VMSTATE_UINT16(damage_ctrl, VGACommonState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 const VMStateDescription vmstate_vga_common = {
     .name = "vga",
     .version_id = 2,
@@ -2150,6 +2319,14 @@ const VMStateDescription vmstate_vga_common = {
         VMSTATE_UINT32(vbe_line_offset, VGACommonState),
         VMSTATE_UINT32(vbe_bank_mask, VGACommonState),
         VMSTATE_END_OF_LIST()
+    },
+    .subsections = (VMStateSubsection []) {
+        {
+            .vmsd = &vmstate_vga_damage,
+            .needed = vga_damage_needed,
+        }, {
+            /* empty */
+        }
     }
 };
 
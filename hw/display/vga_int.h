@@ -48,6 +48,13 @@
 #define VBE_DISPI_INDEX_NB              0xa /* size of vbe_regs[] */
 #define VBE_DISPI_INDEX_VIDEO_MEMORY_64K 0xa /* read-only, not in vbe_regs */
 
+/* damage reporting, std-vga with damage=on only, not in vbe_regs */
+#define VBE_DISPI_INDEX_DAMAGE_CTRL     0xb
+#define VBE_DISPI_INDEX_DAMAGE_X        0xc
+#define VBE_DISPI_INDEX_DAMAGE_Y        0xd
+#define VBE_DISPI_INDEX_DAMAGE_W        0xe
+#define VBE_DISPI_INDEX_DAMAGE_H        0xf /* write commits the rectangle */
+
 #define VBE_DISPI_ID0                   0xB0C0
 #define VBE_DISPI_ID1                   0xB0C1
 #define VBE_DISPI_ID2                   0xB0C2
@@ -62,6 +69,10 @@
 #define VBE_DISPI_LFB_ENABLED           0x40
 #define VBE_DISPI_NOCLEARMEM            0x80
 
+#define VBE_DISPI_DAMAGE_ENABLED        0x01
+
+#define VGA_MAX_DAMAGE                  16
+
 #define VBE_DISPI_LFB_PHYSICAL_ADDRESS  0xE0000000
 
 #define CH_ATTR_SIZE (160 * 100)
@@ -82,6 +93,10 @@ union vga_retrace {
     struct vga_precise_retrace precise;
 };
 
+typedef struct VGADamageRect {
+    uint16_t x, y, w, h;
+} VGADamageRect;
+
 struct VGACommonState;
 typedef uint8_t (* vga_retrace_fn)(struct VGACommonState *s);
 typedef void (* vga_update_retrace_info_fn)(struct VGACommonState *s);
@@ -134,6 +149,13 @@ typedef struct VGACommonState {
     uint32_t vbe_line_offset;
     uint32_t vbe_bank_mask;
     int vbe_mapped;
+    /* guest reported damage, replaces dirty logging while enabled */
+    bool damage_supported;
+    bool damage_log_off;
+    uint16_t damage_ctrl;
+    VGADamageRect damage_cur;
+    VGADamageRect damage[VGA_MAX_DAMAGE];
+    int damage_count;
     /* display refresh support */
     QemuConsole *con;
     uint32_t font_offsets[2];
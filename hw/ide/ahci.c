@@ -521,6 +521,10 @@ static void ahci_reset_port(AHCIState *s, int port)
         ncq_tfs->used = 0;
     }
 
+    /* Completions of cancelled requests must not be reported after reset */
+    d->ncq_done = 0;
+    d->ncq_err = 0;
+
     s->dev[port].port_state = STATE_RUN;
     if (!ide_state->bs) {
         s->dev[port].port_regs.sig = 0;
@@ -729,32 +733,70 @@ out:
     return r;
 }
 
-static void ncq_cb(void *opaque, int ret)
+/* The task file is only updated by ahci_ncq_bh, when the error is
+ * reported, so that a later successful tag cannot hide it. */
+static void ncq_err(NCQTransferState *ncq_tfs)
 {
-    NCQTransferState *ncq_tfs = (NCQTransferState *)opaque;
-    IDEState *ide_state = &ncq_tfs->drive->port.ifs[0];
+    ncq_tfs->drive->ncq_err |= (1 << ncq_tfs->tag);
+    ncq_tfs->drive->port_regs.scr_err |= (1 << ncq_tfs->tag);
+}
 
-    /* Clear bit for this tag in SActive */
-    ncq_tfs->drive->port_regs.scr_act &= ~(1 << ncq_tfs->tag);
+static void ncq_finish(NCQTransferState *ncq_tfs)
+{
+    AHCIDevice *ad = ncq_tfs->drive;
 
-    if (ret < 0) {
-        /* error */
+    DPRINTF(ad->port_no, "NCQ transfer tag %d finished\n", ncq_tfs->tag);
+
+    /*
+     * Completions are reported from a bottom half, so that all tags that
+     * finish in the same main loop iteration share one Set Device Bits FIS
+     * and one interrupt instead of raising one each.
+     */
+    ad->ncq_done |= (1 << ncq_tfs->tag);
+    qemu_bh_schedule(ad->ncq_bh);
+
+    ncq_tfs->used = 0;
+}
+
+static void ahci_ncq_bh(void *opaque)
+{
+    AHCIDevice *ad = opaque;
+    IDEState *ide_state = &ad->port.ifs[0];
+    uint32_t done = ad->ncq_done;
+
+    if (!done) {
+        return;
+    }
+
+    /* Clear bits for the finished tags in SActive */
+    ad->port_regs.scr_act &= ~done;
+
+    if (ad->ncq_err) {
         ide_state->error = ABRT_ERR;
         ide_state->status = READY_STAT | ERR_STAT;
-        ncq_tfs->drive->port_regs.scr_err |= (1 << ncq_tfs->tag);
+        ahci_trigger_irq(ad->hba, ad, PORT_IRQ_STAT_TFES);
     } else {
         ide_state->status = READY_STAT | SEEK_STAT;
     }
+    ad->ncq_done = 0;
+    ad->ncq_err = 0;
+    ahci_write_fis_sdb(ad->hba, ad->port_no, done);
+}
+
+static void ncq_cb(void *opaque, int ret)
+{
+    NCQTransferState *ncq_tfs = (NCQTransferState *)opaque;
+    IDEState *ide_state = &ncq_tfs->drive->port.ifs[0];
 
-    ahci_write_fis_sdb(ncq_tfs->drive->hba, ncq_tfs->drive->port_no,
-                       (1 << ncq_tfs->tag));
+    ncq_tfs->aiocb = NULL;
 
-    DPRINTF(ncq_tfs->drive->port_no, "NCQ transfer tag %d finished\n",
-            ncq_tfs->tag);
+    if (ret < 0) {
+        ncq_err(ncq_tfs);
+    }
 
-    bdrv_acct_done(ncq_tfs->drive->port.ifs[0].bs, &ncq_tfs->acct);
+    bdrv_acct_done(ide_state->bs, &ncq_tfs->acct);
     qemu_sglist_destroy(&ncq_tfs->sglist);
-    ncq_tfs->used = 0;
+    ncq_finish(ncq_tfs);
 }
 
 static void process_ncq_command(AHCIState *s, int port, uint8_t *cmd_fis,
@@ -763,6 +805,8 @@ static void process_ncq_command(AHCIState *s, int port, uint8_t *cmd_fis,
     NCQFrame *ncq_fis = (NCQFrame*)cmd_fis;
     uint8_t tag = ncq_fis->tag >> 3;
     NCQTransferState *ncq_tfs = &s->dev[port].ncq_tfs[tag];
+    IDEState *ide_state = &s->dev[port].port.ifs[0];
+    uint64_t size;
 
     if (ncq_tfs->used) {
         /* error - already in use */
@@ -773,6 +817,8 @@ static void process_ncq_command(AHCIState *s, int port, uint8_t *cmd_fis,
     ncq_tfs->used = 1;
     ncq_tfs->drive = &s->dev[port];
     ncq_tfs->slot = slot;
+    ncq_tfs->tag = tag;
+    ncq_tfs->aiocb = NULL;
     ncq_tfs->lba = ((uint64_t)ncq_fis->lba5 << 40) |
                    ((uint64_t)ncq_fis->lba4 << 32) |
                    ((uint64_t)ncq_fis->lba3 << 24) |
@@ -780,50 +826,72 @@ static void process_ncq_command(AHCIState *s, int port, uint8_t *cmd_fis,
                    ((uint64_t)ncq_fis->lba1 << 8) |
                    (uint64_t)ncq_fis->lba0;
 
-    /* Note: We calculate the sector count, but don't currently rely on it.
-     * The total size of the DMA buffer tells us the transfer size instead. */
+    /* A sector count of zero means 65536 sectors for FPDMA commands */
     ncq_tfs->sector_count = ((uint16_t)ncq_fis->sector_count_high << 8) |
                                 ncq_fis->sector_count_low;
+    if (!ncq_tfs->sector_count) {
+        ncq_tfs->sector_count = 0x10000;
+    }
+    size = (uint64_t)ncq_tfs->sector_count * BDRV_SECTOR_SIZE;
 
     DPRINTF(port, "NCQ transfer LBA from %"PRId64" to %"PRId64", "
             "drive max %"PRId64"\n",
-            ncq_tfs->lba, ncq_tfs->lba + ncq_tfs->sector_count - 2,
-            s->dev[port].port.ifs[0].nb_sectors - 1);
+            ncq_tfs->lba, ncq_tfs->lba + ncq_tfs->sector_count - 1,
+            ide_state->nb_sectors - 1);
 
-    ahci_populate_sglist(&s->dev[port], &ncq_tfs->sglist, 0);
-    ncq_tfs->tag = tag;
+    if (ncq_tfs->lba + ncq_tfs->sector_count > ide_state->nb_sectors) {
+        DPRINTF(port, "error: NCQ transfer beyond end of drive\n");
+        ncq_err(ncq_tfs);
+        ncq_finish(ncq_tfs);
+        return;
+    }
+
+    if (ahci_populate_sglist(&s->dev[port], &ncq_tfs->sglist, 0) < 0) {
+        DPRINTF(port, "error: failed to map NCQ PRDT for tag %d\n", tag);
+        ncq_err(ncq_tfs);
+        ncq_finish(ncq_tfs);
+        return;
+    }
+
+    /* The DMA helpers transfer the whole sglist, so the PRDT must cover at
+     * least the requested sectors.  A larger table is tolerated, as before. */
+    if (ncq_tfs->sglist.size < size) {
+        DPRINTF(port, "error: PRDT describes 0x%"PRIx64" bytes, "
+                "NCQ command wants 0x%"PRIx64"\n",
+                (uint64_t)ncq_tfs->sglist.size, size);
+        qemu_sglist_destroy(&ncq_tfs->sglist);
+        ncq_err(ncq_tfs);
+        ncq_finish(ncq_tfs);
+        return;
+    }
 
     switch(ncq_fis->command) {
         case READ_FPDMA_QUEUED:
             DPRINTF(port, "NCQ reading %d sectors from LBA %"PRId64", "
                     "tag %d\n",
-                    ncq_tfs->sector_count-1, ncq_tfs->lba, ncq_tfs->tag);
-
-            DPRINTF(port, "tag %d aio read %"PRId64"\n",
-                    ncq_tfs->tag, ncq_tfs->lba);
+                    ncq_tfs->sector_count, ncq_tfs->lba, ncq_tfs->tag);
 
-            dma_acct_start(ncq_tfs->drive->port.ifs[0].bs, &ncq_tfs->acct,
+            dma_acct_start(ide_state->bs, &ncq_tfs->acct,
                            &ncq_tfs->sglist, BDRV_ACCT_READ);
-            ncq_tfs->aiocb = dma_bdrv_read(ncq_tfs->drive->port.ifs[0].bs,
+            ncq_tfs->aiocb = dma_bdrv_read(ide_state->bs,
                                            &ncq_tfs->sglist, ncq_tfs->lba,
                                            ncq_cb, ncq_tfs);
             break;
         case WRITE_FPDMA_QUEUED:
             DPRINTF(port, "NCQ writing %d sectors to LBA %"PRId64", tag %d\n",
-                    ncq_tfs->sector_count-1, ncq_tfs->lba, ncq_tfs->tag);
+                    ncq_tfs->sector_count, ncq_tfs->lba, ncq_tfs->tag);
 
-            DPRINTF(port, "tag %d aio write %"PRId64"\n",
-                    ncq_tfs->tag, ncq_tfs->lba);
-
-            dma_acct_start(ncq_tfs->drive->port.ifs[0].bs, &ncq_tfs->acct,
+            dma_acct_start(ide_state->bs, &ncq_tfs->acct,
                            &ncq_tfs->sglist, BDRV_ACCT_WRITE);
-            ncq_tfs->aiocb = dma_bdrv_write(ncq_tfs->drive->port.ifs[0].bs,
+            ncq_tfs->aiocb = dma_bdrv_write(ide_state->bs,
                                             &ncq_tfs->sglist, ncq_tfs->lba,
                                             ncq_cb, ncq_tfs);
             break;
         default:
             DPRINTF(port, "error: tried to process non-NCQ command as NCQ\n");
             qemu_sglist_destroy(&ncq_tfs->sglist);
+            ncq_err(ncq_tfs);
+            ncq_finish(ncq_tfs);
             break;
     }
 }
@@ -1200,11 +1268,18 @@ void ahci_init(AHCIState *s, DeviceState *qdev, DMAContext *dma, int ports)
         ad->port_no = i;
         ad->port.dma = &ad->dma;
         ad->port.dma->ops = &ahci_dma_ops;
+        ad->ncq_bh = qemu_bh_new(ahci_ncq_bh, ad);
     }
 }
 
 void ahci_uninit(AHCIState *s)
 {
+    int i;
+
+    for (i = 0; i < s->ports; i++) {
+        qemu_bh_delete(s->dev[i].ncq_bh);
+    }
+
     memory_region_destroy(&s->mem);
     memory_region_destroy(&s->idp);
     g_free(s->dev);
@@ -1228,6 +1303,26 @@ void ahci_reset(AHCIState *s)
     }
 }
 
+static bool ahci_ncq_done_needed(void *opaque)
+{
+    AHCIDevice *ad = opaque;
+
+    return ad->ncq_done != 0;
+}
+
+/* NCQ completions that the bottom half has not reported yet */
+static const VMStateDescription vmstate_ahci_ncq_done = {
+    .name = "ahci port/ncq_done",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField []) {
+        VMSTATE_UINT32(ncq_done, AHCIDevice),
+        VMSTATE_UINT32(ncq_err, AHCIDevice),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription vmstate_ahci_device = {
     .name = "ahci port",
     .version_id = 1,
@@ -1254,6 +1349,14 @@ static const VMStateDescription vmstate_ahci_device = {
         VMSTATE_BOOL(init_d2h_sent, AHCIDevice),
         VMSTATE_END_OF_LIST()
     },
+    .subsections = (VMStateSubsection []) {
+        {
+            .vmsd = &vmstate_ahci_ncq_done,
+            .needed = ahci_ncq_done_needed,
+        }, {
+            /* empty */
+        }
+    }
 };
 
 static int ahci_state_post_load(void *opaque, int version_id)
@@ -1281,6 +1384,9 @@ static int ahci_state_post_load(void *opaque, int version_id)
             ad->busy_slot = -1;
         }
         check_cmd(s, i);
+        if (ad->ncq_done) {
+            qemu_bh_schedule(ad->ncq_bh);
+        }
     }
 
     return 0;
@@ -265,7 +265,7 @@ typedef struct NCQTransferState {
     BlockDriverAIOCB *aiocb;
     QEMUSGList sglist;
     BlockAcctCookie acct;
-    uint16_t sector_count;
+    uint32_t sector_count;
     uint64_t lba;
     uint8_t tag;
     int slot;
@@ -288,6 +288,9 @@ struct AHCIDevice {
     bool init_d2h_sent;
     AHCICmdHdr *cur_cmd;
     NCQTransferState ncq_tfs[AHCI_MAX_CMDS];
+    QEMUBH *ncq_bh;
+    uint32_t ncq_done;      /* NCQ tags completed, not yet reported */
+    uint32_t ncq_err;       /* those of ncq_done that failed */
 };
 
 typedef struct AHCIState {
@@ -295,6 +295,16 @@ struct BlockDriverState {
     QEMUTimer    *block_timer;
     bool         io_limits_enabled;
 
+    /* BLOCK_IO_THROTTLE events, see bdrv_set_io_throttle_events() */
+    int64_t      throttle_event_interval;   /* ns of rt_clock, 0 = off */
+    int64_t      throttle_event_last;
+    int64_t      throttle_busy_since;
+    QEMUTimer    *throttle_event_timer;
+    int          throttle_queued;           /* requests waiting */
+    int          throttle_event_state;
+    uint64_t     throttle_event_bytes[BDRV_MAX_IOTYPE];
+    uint64_t     throttle_event_ops[BDRV_MAX_IOTYPE];
+
     /* I/O stats (display with "info blockstats"). */
     uint64_t nr_bytes[BDRV_MAX_IOTYPE];
     uint64_t nr_ops[BDRV_MAX_IOTYPE];
@@ -325,7 +335,7 @@ struct BlockDriverState {
     bool iostatus_enabled;
     BlockDeviceIoStatus iostatus;
     char device_name[32];
-    HBitmap *dirty_bitmap;
+    QTAILQ_HEAD(, BdrvDirtyBitmap) dirty_bitmaps;
     int refcnt;
     int in_use; /* users other than guest access, eg. block migration */
     QTAILQ_ENTRY(BlockDriverState) list;
@@ -31,6 +31,8 @@ MemoryRegionSection *phys_page_find(struct AddressSpaceDispatch *d,
 void cpu_tlb_reset_dirty_all(ram_addr_t start1, ram_addr_t length);
 void tlb_set_dirty(CPUArchState *env, target_ulong vaddr);
 extern int tlb_flush_count;
+extern int tlb_fill_count;
+extern int tlb_victim_hit_count;
 
 /* exec.c */
 void tb_flush_jmp_cache(CPUArchState *env, target_ulong addr);
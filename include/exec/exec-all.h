@@ -21,6 +21,7 @@
 #define _EXEC_ALL_H_
 
 #include "qemu-common.h"
+#include "qemu/atomic.h"
 
 /* allow to see translation results - the slowdown should be negligible, so we leave it */
 #define DEBUG_DISAS
@@ -101,6 +102,8 @@ void tlb_flush(CPUArchState *env, int flush_global);
 void tlb_set_page(CPUArchState *env, target_ulong vaddr,
                   hwaddr paddr, int prot,
                   int mmu_idx, target_ulong size);
+bool tlb_victim_hit(CPUArchState *env, int mmu_idx, int index,
+                    size_t elt_ofs, target_ulong page);
 void tb_invalidate_phys_addr(hwaddr addr);
 #else
 static inline void tlb_flush_page(CPUArchState *env, target_ulong addr)
@@ -166,6 +169,13 @@ struct TranslationBlock {
     struct TranslationBlock *jmp_next[2];
     struct TranslationBlock *jmp_first;
     uint32_t icount;
+    /* set once the TB has been unlinked by tb_phys_invalidate() */
+    uint8_t invalid;
+#ifdef CONFIG_PROFILER
+    /* number of times cpu_exec looked up this TB; executions reached
+       through chained jumps are not counted */
+    uint64_t exec_count;
+#endif
 };
 
 #include "exec/spinlock.h"
@@ -174,17 +184,24 @@ typedef struct TBContext TBContext;
 
 struct TBContext {
 
+    /* ring of code_gen_max_blocks TBs; the nb_tbs live ones start at
+       tb_tail and are in code_gen_buffer order, wrapping at most once */
     TranslationBlock *tbs;
     TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
     int nb_tbs;
+    int tb_tail;
     /* any access to the tbs or the page table must use this lock */
     spinlock_t tb_lock;
 
     /* statistics */
     int tb_flush_count;
     int tb_phys_invalidate_count;
+    int tb_evict_count;
 
-    int tb_invalidated_flag;
+    /* bumped whenever a TB is invalidated or its slot reused; cpu_exec
+       only chains two TBs if it did not change since the first one was
+       looked up */
+    unsigned int tb_invalidated_gen;
 };
 
 static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
@@ -226,8 +243,9 @@ void ppc_tb_set_jmp_target(unsigned long jmp_addr, unsigned long addr);
 #elif defined(__i386__) || defined(__x86_64__)
 static inline void tb_set_jmp_target1(uintptr_t jmp_addr, uintptr_t addr)
 {
-    /* patch the branch destination */
-    *(uint32_t *)jmp_addr = addr - (jmp_addr + 4);
+    /* patch the branch destination; the backend aligns the displacement
+       so this store cannot tear under a concurrently running vCPU */
+    atomic_set((uint32_t *)jmp_addr, addr - (jmp_addr + 4));
     /* no need to flush icache explicitly */
 }
 #elif defined(__arm__)
@@ -273,7 +291,7 @@ static inline void tb_set_jmp_target(TranslationBlock *tb,
 static inline void tb_set_jmp_target(TranslationBlock *tb,
                                      int n, uintptr_t addr)
 {
-    tb->tb_next[n] = addr;
+    atomic_set(&tb->tb_next[n], addr);
 }
 
 #endif
@@ -53,6 +53,7 @@ typedef enum MonitorEvent {
     QEVENT_GUEST_PANICKED,
     QEVENT_BLOCK_IMAGE_CORRUPTED,
     QEVENT_VSERPORT_CHANGE,
+    QEVENT_BLOCK_IO_THROTTLE,
 
     /* Add to 'monitor_event_names' array in monitor.c when
      * defining new events here */
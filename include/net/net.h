@@ -77,6 +77,9 @@ struct NetClientState {
     NetClientDestructor *destructor;
     unsigned int queue_index;
     unsigned rxfilter_notify_enabled:1;
+    /* packets and bytes delivered to and from this client */
+    uint64_t rx_bytes, rx_packets;
+    uint64_t tx_bytes, tx_packets;
 };
 
 typedef struct NICState {
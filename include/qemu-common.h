@@ -281,6 +281,7 @@ typedef struct PCIHostDeviceAddress {
 } PCIHostDeviceAddress;
 
 void tcg_exec_init(unsigned long tb_size);
+void tb_perf_map_enable(void);
 bool tcg_enabled(void);
 
 void cpu_exec_init_all(void);
@@ -333,11 +334,18 @@ ssize_t qemu_co_send_recv(int sockfd, void *buf, size_t bytes, bool do_send);
 #define qemu_co_send(sockfd, buf, bytes) \
   qemu_co_send_recv(sockfd, buf, bytes, true)
 
+/* Number of elements stored inside the QEMUIOVector itself.  Vectors
+ * initialized with qemu_iovec_init() only allocate memory when they grow
+ * past this, so a QEMUIOVector must not be copied by value.
+ */
+#define QEMU_IOVEC_INLINE 8
+
 typedef struct QEMUIOVector {
     struct iovec *iov;
     int niov;
     int nalloc;
     size_t size;
+    struct iovec inline_iov[QEMU_IOVEC_INLINE];
 } QEMUIOVector;
 
 void qemu_iovec_init(QEMUIOVector *qiov, int alloc_hint);
@@ -108,6 +108,14 @@ void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count);
  */
 void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count);
 
+/**
+ * hbitmap_reset_all:
+ * @hb: HBitmap to operate on.
+ *
+ * Reset all bits in an HBitmap.
+ */
+void hbitmap_reset_all(HBitmap *hb);
+
 /**
  * hbitmap_get:
  * @hb: HBitmap to operate on.
@@ -117,6 +125,77 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count);
  */
 bool hbitmap_get(const HBitmap *hb, uint64_t item);
 
+/**
+ * hbitmap_merge:
+ * @a: HBitmap to merge into.
+ * @b: HBitmap to merge from.
+ *
+ * Set in @a every bit that is set in @b.  Only the nonzero words of @b
+ * are visited.  Return false, and leave @a untouched, if the two bitmaps
+ * do not have the same size and granularity.
+ */
+bool hbitmap_merge(HBitmap *a, const HBitmap *b);
+
+/**
+ * hbitmap_serialization_granularity:
+ * @hb: HBitmap to operate on.
+ *
+ * Return the number of items that a serialized unit covers.  Ranges
+ * passed to the serialization functions must start on a multiple of it,
+ * and their length must be a multiple of it unless they reach the end
+ * of the bitmap.
+ */
+uint64_t hbitmap_serialization_granularity(const HBitmap *hb);
+
+/**
+ * hbitmap_serialization_size:
+ * @hb: HBitmap to operate on.
+ * @start: First item of the range (0-based).
+ * @count: Number of items in the range.
+ *
+ * Return the number of bytes hbitmap_serialize_part needs for the range.
+ */
+uint64_t hbitmap_serialization_size(const HBitmap *hb,
+                                    uint64_t start, uint64_t count);
+
+/**
+ * hbitmap_serialize_part:
+ * @hb: HBitmap to operate on.
+ * @buf: Buffer of hbitmap_serialization_size bytes.
+ * @start: First item of the range (0-based).
+ * @count: Number of items in the range.
+ *
+ * Store the bits of the range in @buf, one bit per granularity group,
+ * in little-endian 64-bit units, least significant bit first.  The
+ * format does not depend on the host's word size or endianness.
+ */
+void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
+                            uint64_t start, uint64_t count);
+
+/**
+ * hbitmap_deserialize_part:
+ * @hb: HBitmap to operate on.
+ * @buf: Buffer filled by hbitmap_serialize_part.
+ * @start: First item of the range (0-based).
+ * @count: Number of items in the range.
+ * @finish: Whether to call hbitmap_deserialize_finish.
+ *
+ * Load the bits of the range from @buf.  Only the bottom level is written,
+ * so the bitmap must not be used until hbitmap_deserialize_finish is
+ * called; pass @finish=false for all parts but the last.
+ */
+void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
+                              uint64_t start, uint64_t count,
+                              bool finish);
+
+/**
+ * hbitmap_deserialize_finish:
+ * @hb: HBitmap to operate on.
+ *
+ * Recompute the upper levels and the count after deserialization.
+ */
+void hbitmap_deserialize_finish(HBitmap *hb);
+
 /**
  * hbitmap_free:
  * @hb: HBitmap to operate on.
@@ -0,0 +1,72 @@
+/*
+ * Device statistics in shared memory
+ *
+ * Copyright (c) 2013 the QEMU project contributors
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_STATS_SHM_H
+#define QEMU_STATS_SHM_H
+
+#include "qemu-common.h"
+#include "qemu/option.h"
+
+/*
+ * Layout of the file written by -stats-shm, see docs/specs/stats-shm.txt.
+ * All fields are in host byte order.  Only ever add fields at the end of
+ * a record and bump STATS_SHM_VERSION when the meaning of a field changes.
+ */
+
+#define STATS_SHM_MAGIC     0x53545351  /* "QSTS" in little endian */
+#define STATS_SHM_VERSION   1
+#define STATS_SHM_NAME_LEN  32
+
+enum {
+    STATS_SHM_BLOCK = 1,
+    STATS_SHM_NET   = 2,
+};
+
+/* index into the per-direction arrays */
+enum {
+    STATS_SHM_READ  = 0,    /* rx for net devices */
+    STATS_SHM_WRITE = 1,    /* tx for net devices */
+    STATS_SHM_FLUSH = 2,
+    STATS_SHM_TOTAL = 2,    /* index of the total limit */
+    STATS_SHM_NDIR  = 3,
+};
+
+typedef struct StatsShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t record_size;
+    uint32_t max_records;
+    uint32_t nr_records;
+    /* incremented whenever records are added or removed */
+    uint32_t generation;
+    uint32_t pad;
+    /* rt_clock nanoseconds at the last update */
+    uint64_t update_ns;
+} StatsShmHeader;
+
+typedef struct StatsShmRecord {
+    /* odd while QEMU is writing the record; a reader must retry if it
+       sees an odd value or if the value changed while it copied */
+    uint32_t seq;
+    uint32_t type;
+    char name[STATS_SHM_NAME_LEN];
+    uint64_t nr_bytes[STATS_SHM_NDIR];
+    uint64_t nr_ops[STATS_SHM_NDIR];
+    uint64_t total_time_ns[STATS_SHM_NDIR];
+    /* requests waiting in the throttle queue */
+    uint64_t queue_depth;
+    /* current I/O limits, 0 = unlimited; read, write, total */
+    uint64_t bps[STATS_SHM_NDIR];
+    uint64_t iops[STATS_SHM_NDIR];
+} StatsShmRecord;
+
+int stats_shm_init(QemuOpts *opts);
+
+#endif
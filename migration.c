@@ -364,6 +364,12 @@ void remove_migration_state_change_notifier(Notifier *notify)
     notifier_remove(notify);
 }
 
+bool migration_is_active(MigrationState *s)
+{
+    return (s->state == MIG_STATE_ACTIVE || s->state == MIG_STATE_SETUP ||
+            s->state == MIG_STATE_CANCELLING);
+}
+
 bool migration_in_setup(MigrationState *s)
 {
     return s->state == MIG_STATE_SETUP;
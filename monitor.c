@@ -309,19 +309,18 @@ void monitor_flush(Monitor *mon)
 /* flush at every end of line */
 static void monitor_puts(Monitor *mon, const char *str)
 {
-    char c;
+    const char *nl;
 
-    for(;;) {
-        c = *str++;
-        if (c == '\0')
+    while (*str) {
+        nl = strchr(str, '\n');
+        if (!nl) {
+            qstring_append(mon->outbuf, str);
             break;
-        if (c == '\n') {
-            qstring_append_chr(mon->outbuf, '\r');
-        }
-        qstring_append_chr(mon->outbuf, c);
-        if (c == '\n') {
-            monitor_flush(mon);
         }
+        qstring_append_len(mon->outbuf, str, nl - str);
+        qstring_append(mon->outbuf, "\r\n");
+        monitor_flush(mon);
+        str = nl + 1;
     }
 }
 
@@ -507,6 +506,7 @@ static const char *monitor_event_names[] = {
     [QEVENT_GUEST_PANICKED] = "GUEST_PANICKED",
     [QEVENT_BLOCK_IMAGE_CORRUPTED] = "BLOCK_IMAGE_CORRUPTED",
     [QEVENT_VSERPORT_CHANGE] = "VSERPORT_CHANGE",
+    [QEVENT_BLOCK_IO_THROTTLE] = "BLOCK_IO_THROTTLE",
 };
 QEMU_BUILD_BUG_ON(ARRAY_SIZE(monitor_event_names) != QEVENT_MAX)
 
@@ -394,6 +394,15 @@ int qemu_can_send_packet(NetClientState *sender)
     return 1;
 }
 
+static void qemu_net_account(NetClientState *sender, NetClientState *nc,
+                             ssize_t size)
+{
+    nc->rx_bytes += size;
+    nc->rx_packets++;
+    sender->tx_bytes += size;
+    sender->tx_packets++;
+}
+
 ssize_t qemu_deliver_packet(NetClientState *sender,
                             unsigned flags,
                             const uint8_t *data,
@@ -419,7 +428,9 @@ ssize_t qemu_deliver_packet(NetClientState *sender,
 
     if (ret == 0) {
         nc->receive_disabled = 1;
-    };
+    } else if (ret > 0) {
+        qemu_net_account(sender, nc, ret);
+    }
 
     return ret;
 }
@@ -527,6 +538,8 @@ ssize_t qemu_deliver_packet_iov(NetClientState *sender,
 
     if (ret == 0) {
         nc->receive_disabled = 1;
+    } else if (ret > 0) {
+        qemu_net_account(sender, nc, ret);
     }
 
     return ret;
@@ -1220,6 +1220,17 @@ This can be really helpful to save bandwidth when playing videos. Disabling
 adaptive encodings allows to restore the original static behavior of encodings
 like Tight.
 
+Adaptive mode also estimates each client's throughput from how fast its
+output backlog drains: incremental updates are not encoded faster than the
+link can carry them, and the JPEG quality requested by the client is lowered
+while its link is slow.
+
+@item cpu-limit=@var{percent}
+
+Limit the host CPU time spent encoding updates for each client to
+@var{percent} of one CPU, by delaying incremental updates after expensive
+ones.  By default encoding is not limited.
+
 @item share=[allow-exclusive|force-shared|ignore]
 
 Set display sharing policy.  'allow-exclusive' allows clients to ask
@@ -2898,7 +2909,21 @@ DEF("tb-size", HAS_ARG, QEMU_OPTION_tb_size, \
 STEXI
 @item -tb-size @var{n}
 @findex -tb-size
-Set TB size.
+Set TB size, the size in megabytes of the buffer holding translated code.
+The default is a quarter of the guest RAM size, but at least 32 MB and at
+most an eighth of the host memory.  When the buffer is full, the oldest
+translations are discarded to make room.
+ETEXI
+
+DEF("perfmap", 0, QEMU_OPTION_perfmap, \
+    "-perfmap        write /tmp/perf-<pid>.map for translated code\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -perfmap
+@findex -perfmap
+Write a map of the translated code to @file{/tmp/perf-<pid>.map}, so that
+the Linux @command{perf} tool can attribute samples in generated code to
+guest addresses.  Only meaningful when running with TCG.
 ETEXI
 
 DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
@@ -3104,6 +3129,23 @@ STEXI
 prepend a timestamp to each log message.(default:on)
 ETEXI
 
+#ifdef CONFIG_POSIX
+DEF("stats-shm", HAS_ARG, QEMU_OPTION_stats_shm,
+    "-stats-shm [path=]file[,interval=ms][,records=n]\n"
+    "                publish block and NIC counters in a shared file\n",
+    QEMU_ARCH_ALL)
+#endif
+STEXI
+@item -stats-shm [path=]@var{file}[,interval=@var{ms}][,records=@var{n}]
+@findex -stats-shm
+Every @var{ms} milliseconds (default 100), copy the counters of each named
+block device and each NIC into @var{file}, for example a file under
+@file{/dev/shm}, with room for @var{n} devices (default 256).  Host agents
+can mmap the file instead of polling @code{query-blockstats}.  The layout
+is described in @file{docs/specs/stats-shm.txt}.  The file is removed when
+QEMU exits.  The option can be given only once.
+ETEXI
+
 DEF("dump-vmstate", HAS_ARG, QEMU_OPTION_dump_vmstate,
     "-dump-vmstate <file>\n"
     "                Output vmstate information in JSON format to file.\n"
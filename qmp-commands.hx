@@ -1567,6 +1567,143 @@ Example:
                                                "iops_wr": "0" } }
 <- { "return": {} }
 
+EQMP
+
+    {
+        .name       = "block-set-io-throttle-batch",
+        .args_type  = "limits:q",
+        .mhandler.cmd_new = qmp_marshal_input_block_set_io_throttle_batch,
+    },
+
+SQMP
+block-set-io-throttle-batch
+---------------------------
+
+Change the I/O throttle limits of several block drives at once.  All
+entries are validated first; if any of them fails, no drive is changed.
+
+Arguments:
+
+- "limits": list of limits, one per device (json-array); each element has
+  the same members as the arguments of block_set_io_throttle
+
+Example:
+
+-> { "execute": "block-set-io-throttle-batch",
+     "arguments": { "limits": [
+         { "device": "virtio0", "bps": 2000000, "bps_rd": 0, "bps_wr": 0,
+           "iops": 0, "iops_rd": 0, "iops_wr": 0 },
+         { "device": "virtio1", "bps": 1000000, "bps_rd": 0, "bps_wr": 0,
+           "iops": 0, "iops_rd": 0, "iops_wr": 0 } ] } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "block-set-io-throttle-events",
+        .args_type  = "device:B,interval:l",
+        .mhandler.cmd_new = qmp_marshal_input_block_set_io_throttle_events,
+    },
+
+SQMP
+block-set-io-throttle-events
+----------------------------
+
+Enable or disable BLOCK_IO_THROTTLE events for a block drive.
+
+Arguments:
+
+- "device": device name (json-string)
+- "interval": minimum time between two events in milliseconds, at most
+  one day (86400000); 0 disables the events (json-int)
+
+Example:
+
+-> { "execute": "block-set-io-throttle-events",
+     "arguments": { "device": "virtio0", "interval": 500 } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "block-dirty-bitmap-add",
+        .args_type  = "device:B,name:s,granularity:i?",
+        .mhandler.cmd_new = qmp_marshal_input_block_dirty_bitmap_add,
+    },
+
+SQMP
+block-dirty-bitmap-add
+----------------------
+
+Create a named dirty bitmap on a block drive.  Writes to the drive are
+recorded in every bitmap of the drive, including those of a running
+mirror job or block migration.  While the drive has named bitmaps,
+block_resize is refused; ejecting or changing the medium releases them.
+
+Arguments:
+
+- "device": device name (json-string)
+- "name": bitmap name, unique for the device (json-string)
+- "granularity": bitmap granularity in bytes, a power of two between 512
+  and 64M (json-int, optional, default 65536)
+
+Example:
+
+-> { "execute": "block-dirty-bitmap-add",
+     "arguments": { "device": "virtio0", "name": "backup0",
+                    "granularity": 1048576 } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "block-dirty-bitmap-remove",
+        .args_type  = "device:B,name:s",
+        .mhandler.cmd_new = qmp_marshal_input_block_dirty_bitmap_remove,
+    },
+
+SQMP
+block-dirty-bitmap-remove
+-------------------------
+
+Free a named dirty bitmap.
+
+Arguments:
+
+- "device": device name (json-string)
+- "name": bitmap name (json-string)
+
+Example:
+
+-> { "execute": "block-dirty-bitmap-remove",
+     "arguments": { "device": "virtio0", "name": "backup0" } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "block-dirty-bitmap-clear",
+        .args_type  = "device:B,name:s",
+        .mhandler.cmd_new = qmp_marshal_input_block_dirty_bitmap_clear,
+    },
+
+SQMP
+block-dirty-bitmap-clear
+------------------------
+
+Mark all sectors of a named dirty bitmap clean.
+
+Arguments:
+
+- "device": device name (json-string)
+- "name": bitmap name (json-string)
+
+Example:
+
+-> { "execute": "block-dirty-bitmap-clear",
+     "arguments": { "device": "virtio0", "name": "backup0" } }
+<- { "return": {} }
+
 EQMP
 
     {
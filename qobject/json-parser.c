@@ -210,12 +210,14 @@ static QString *qstring_from_escaped_str(JSONParserContext *ctxt,
                 goto out;
             }
         } else {
-            char dummy[2];
+            /* copy everything up to the next escape or quote at once */
+            const char *run = ptr;
 
-            dummy[0] = *ptr++;
-            dummy[1] = 0;
-
-            qstring_append(str, dummy);
+            while (*ptr && *ptr != '\\' &&
+                   *ptr != (double_quote ? '"' : '\'')) {
+                ptr++;
+            }
+            qstring_append_len(str, run, ptr - run);
         }
     }
 
@@ -86,8 +86,14 @@ static void capacity_increase(QString *qstring, size_t len)
  */
 void qstring_append(QString *qstring, const char *str)
 {
-    size_t len = strlen(str);
+    qstring_append_len(qstring, str, strlen(str));
+}
 
+/**
+ * qstring_append_len(): Append the first len bytes of str to a QString
+ */
+void qstring_append_len(QString *qstring, const char *str, size_t len)
+{
     capacity_increase(qstring, len);
     memcpy(qstring->string + qstring->length, str, len);
     qstring->length += len;
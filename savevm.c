@@ -42,6 +42,7 @@
 #include "qemu/bitops.h"
 #include "qemu/iov.h"
 #include "block/snapshot.h"
+#include "block/coroutine.h"
 #include "block/qapi.h"
 
 #define SELF_ANNOUNCE_ROUNDS 5
@@ -562,9 +563,95 @@ static int block_put_buffer(void *opaque, const uint8_t *buf,
     return size;
 }
 
+/*
+ * The VM state is read back in large chunks.  While one chunk is being
+ * parsed the next one is read from a coroutine, so that the image I/O
+ * overlaps with loading RAM and devices.
+ */
+#define BDRV_READAHEAD_SIZE (1024 * 1024)
+
+typedef struct BdrvReadahead {
+    BlockDriverState *bs;
+    uint8_t *buf;
+    int64_t pos;
+    int len;
+    uint8_t *next_buf;
+    int64_t next_pos;
+    int next_len;
+    bool next_busy;
+} BdrvReadahead;
+
+static void coroutine_fn block_readahead_co(void *opaque)
+{
+    BdrvReadahead *r = opaque;
+
+    r->next_len = bdrv_load_vmstate(r->bs, r->next_buf, r->next_pos,
+                                    BDRV_READAHEAD_SIZE);
+    r->next_busy = false;
+}
+
+static void block_readahead_wait(BdrvReadahead *r)
+{
+    while (r->next_busy) {
+        qemu_aio_wait();
+    }
+}
+
+static void block_readahead_start(BdrvReadahead *r, int64_t pos)
+{
+    Coroutine *co;
+
+    block_readahead_wait(r);
+    r->next_pos = pos;
+    r->next_len = 0;
+    r->next_busy = true;
+    co = qemu_coroutine_create(block_readahead_co);
+    qemu_coroutine_enter(co, r);
+}
+
 static int block_get_buffer(void *opaque, uint8_t *buf, int64_t pos, int size)
 {
-    return bdrv_load_vmstate(opaque, buf, pos, size);
+    BdrvReadahead *r = opaque;
+    uint8_t *tmp;
+
+    if (pos < r->pos || pos >= r->pos + r->len) {
+        block_readahead_wait(r);
+        if (r->next_len > 0 && r->next_pos == pos) {
+            tmp = r->buf;
+            r->buf = r->next_buf;
+            r->next_buf = tmp;
+            r->pos = r->next_pos;
+            r->len = r->next_len;
+        } else {
+            r->pos = pos;
+            r->len = bdrv_load_vmstate(r->bs, r->buf, pos,
+                                       BDRV_READAHEAD_SIZE);
+            if (r->len <= 0) {
+                /* Fall back to the exact request, e.g. near the end of
+                 * an image format that cannot read past the state */
+                r->len = 0;
+                return bdrv_load_vmstate(r->bs, buf, pos, size);
+            }
+        }
+        block_readahead_start(r, r->pos + r->len);
+    }
+
+    size = MIN(size, r->pos + r->len - pos);
+    memcpy(buf, r->buf + (pos - r->pos), size);
+    return size;
+}
+
+static int block_read_close(void *opaque)
+{
+    BdrvReadahead *r = opaque;
+    int ret;
+
+    block_readahead_wait(r);
+    ret = bdrv_flush(r->bs);
+    qemu_vfree(r->buf);
+    qemu_vfree(r->next_buf);
+    g_free(r);
+    return ret;
 }
 
 static int bdrv_fclose(void *opaque)
@@ -574,7 +661,7 @@ static int bdrv_fclose(void *opaque)
 
 static const QEMUFileOps bdrv_read_ops = {
     .get_buffer = block_get_buffer,
-    .close =      bdrv_fclose
+    .close =      block_read_close
 };
 
 static const QEMUFileOps bdrv_write_ops = {
@@ -585,9 +672,16 @@ static const QEMUFileOps bdrv_write_ops = {
 
 static QEMUFile *qemu_fopen_bdrv(BlockDriverState *bs, int is_writable)
 {
+    BdrvReadahead *r;
+
     if (is_writable)
         return qemu_fopen_ops(bs, &bdrv_write_ops);
-    return qemu_fopen_ops(bs, &bdrv_read_ops);
+
+    r = g_malloc0(sizeof(*r));
+    r->bs = bs;
+    r->buf = qemu_blockalign(bs, BDRV_READAHEAD_SIZE);
+    r->next_buf = qemu_blockalign(bs, BDRV_READAHEAD_SIZE);
+    return qemu_fopen_ops(r, &bdrv_read_ops);
 }
 
 QEMUFile *qemu_fopen_ops(void *opaque, const QEMUFileOps *ops)
@@ -1879,6 +1973,97 @@ static void *vmstate_base_addr(void *opaque, VMStateField *field)
     return base_addr;
 }
 
+/* Arrays of plain integers are transferred with one buffer copy per chunk
+ * instead of one get/put call per element.  The stream format is the same:
+ * every element is big endian.  Return the element size if the field
+ * qualifies, 0 otherwise.
+ */
+#define VMSTATE_BULK_CHUNK 1024
+
+static int vmstate_bulk_size(VMStateField *field, int size)
+{
+    const VMStateInfo *info = field->info;
+
+    if (field->flags & (VMS_STRUCT | VMS_ARRAY_OF_POINTER)) {
+        return 0;
+    }
+    if ((info == &vmstate_info_uint8 || info == &vmstate_info_int8) &&
+        size == 1) {
+        return 1;
+    }
+    if ((info == &vmstate_info_uint16 || info == &vmstate_info_int16) &&
+        size == 2) {
+        return 2;
+    }
+    if ((info == &vmstate_info_uint32 || info == &vmstate_info_int32) &&
+        size == 4) {
+        return 4;
+    }
+    if ((info == &vmstate_info_uint64 || info == &vmstate_info_int64) &&
+        size == 8) {
+        return 8;
+    }
+    return 0;
+}
+
+static void vmstate_put_bulk(QEMUFile *f, const uint8_t *p, int n, int size)
+{
+    uint8_t buf[VMSTATE_BULK_CHUNK];
+    int i, chunk;
+
+    if (size == 1) {
+        qemu_put_buffer(f, p, n);
+        return;
+    }
+    while (n > 0) {
+        chunk = MIN(n, VMSTATE_BULK_CHUNK / size);
+        for (i = 0; i < chunk; i++, p += size) {
+            switch (size) {
+            case 2:
+                stw_be_p(buf + i * 2, *(uint16_t *)p);
+                break;
+            case 4:
+                stl_be_p(buf + i * 4, *(uint32_t *)p);
+                break;
+            default:
+                stq_be_p(buf + i * 8, *(uint64_t *)p);
+                break;
+            }
+        }
+        qemu_put_buffer(f, buf, chunk * size);
+        n -= chunk;
+    }
+}
+
+static void vmstate_get_bulk(QEMUFile *f, uint8_t *p, int n, int size)
+{
+    uint8_t buf[VMSTATE_BULK_CHUNK];
+    int i, chunk;
+
+    if (size == 1) {
+        qemu_get_buffer(f, p, n);
+        return;
+    }
+    while (n > 0) {
+        chunk = MIN(n, VMSTATE_BULK_CHUNK / size);
+        qemu_get_buffer(f, buf, chunk * size);
+        for (i = 0; i < chunk; i++, p += size) {
+            switch (size) {
+            case 2:
+                *(uint16_t *)p = lduw_be_p(buf + i * 2);
+                break;
+            case 4:
+                *(uint32_t *)p = ldl_be_p(buf + i * 4);
+                break;
+            default:
+                *(uint64_t *)p = ldq_be_p(buf + i * 8);
+                break;
+            }
+        }
+        n -= chunk;
+    }
+}
+
 int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
                        void *opaque, int version_id)
 {
@@ -1908,6 +2093,10 @@ int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
             int i, n_elems = vmstate_n_elems(opaque, field);
             int size = vmstate_size(opaque, field);
 
+            if (n_elems > 1 && vmstate_bulk_size(field, size)) {
+                vmstate_get_bulk(f, base_addr, n_elems, size);
+                n_elems = 0;
+            }
             for (i = 0; i < n_elems; i++) {
                 void *addr = base_addr + size * i;
 
@@ -1956,6 +2145,10 @@ void vmstate_save_state(QEMUFile *f, const VMStateDescription *vmsd,
             int i, n_elems = vmstate_n_elems(opaque, field);
             int size = vmstate_size(opaque, field);
 
+            if (n_elems > 1 && vmstate_bulk_size(field, size)) {
+                vmstate_put_bulk(f, base_addr, n_elems, size);
+                n_elems = 0;
+            }
             for (i = 0; i < n_elems; i++) {
                 void *addr = base_addr + size * i;
 
@@ -2593,19 +2786,243 @@ static int del_existing_snapshots(Monitor *mon, const char *name)
     return 0;
 }
 
+/* Resolve the snapshot name and ID.  If @name matches an existing
+ * snapshot, its ID is reused so that the replacement keeps it.
+ */
+static void savevm_set_name(BlockDriverState *bs, QEMUSnapshotInfo *sn,
+                            const char *name, qemu_timeval *tv)
+{
+    QEMUSnapshotInfo old_sn1, *old_sn = &old_sn1;
+    struct tm tm;
+
+    if (name) {
+        if (bdrv_snapshot_find(bs, old_sn, name) >= 0) {
+            pstrcpy(sn->name, sizeof(sn->name), old_sn->name);
+            pstrcpy(sn->id_str, sizeof(sn->id_str), old_sn->id_str);
+        } else {
+            pstrcpy(sn->name, sizeof(sn->name), name);
+        }
+    } else {
+        /* cast below needed for OpenBSD where tv_sec is still 'long' */
+        localtime_r((const time_t *)&tv->tv_sec, &tm);
+        strftime(sn->name, sizeof(sn->name), "vm-%Y%m%d%H%M%S", &tm);
+    }
+}
+
+static void savevm_set_time(QEMUSnapshotInfo *sn, qemu_timeval *tv)
+{
+    sn->date_sec = tv->tv_sec;
+    sn->date_nsec = tv->tv_usec * 1000;
+    sn->vm_clock_nsec = qemu_get_clock_ns(vm_clock);
+}
+
+static void savevm_create_snapshots(BlockDriverState *bs,
+                                    QEMUSnapshotInfo *sn,
+                                    uint64_t vm_state_size)
+{
+    BlockDriverState *bs1;
+    int ret;
+
+    bs1 = NULL;
+    while ((bs1 = bdrv_next(bs1))) {
+        if (bdrv_can_snapshot(bs1)) {
+            /* Write VM state size only to the image that contains the state */
+            sn->vm_state_size = (bs == bs1 ? vm_state_size : 0);
+            ret = bdrv_snapshot_create(bs1, sn);
+            if (ret < 0) {
+                error_report("Error while creating snapshot on '%s'",
+                             bdrv_get_device_name(bs1));
+            }
+        }
+    }
+}
+
+/*
+ * Live savevm: RAM is copied into the vmstate area from a timer in the
+ * main loop while the guest runs, using the same dirty tracking as live
+ * migration.  The guest is stopped only for the last dirty pages, the
+ * device state and the disk snapshots.
+ */
+
+/* Interval used to estimate the vmstate write bandwidth, in ms */
+#define SAVEVM_LIVE_DELAY 100
+
+typedef struct SaveVMLiveState {
+    QEMUTimer *timer;
+    QEMUFile *file;
+    BlockDriverState *bs;
+    QEMUSnapshotInfo sn;
+    Error *blocker;
+    int64_t sample_time;
+    uint64_t sample_bytes;
+    uint64_t max_size;
+} SaveVMLiveState;
+
+static SaveVMLiveState *savevm_live;
+
+static void savevm_live_cleanup(SaveVMLiveState *s)
+{
+    qemu_del_timer(s->timer);
+    qemu_free_timer(s->timer);
+    migrate_del_blocker(s->blocker);
+    error_free(s->blocker);
+    bdrv_set_in_use(s->bs, 0);
+    g_free(s);
+    savevm_live = NULL;
+}
+
+static void savevm_live_complete(SaveVMLiveState *s)
+{
+    uint64_t vm_state_size;
+    qemu_timeval tv;
+    int saved_vm_running;
+    int ret;
+
+    saved_vm_running = runstate_is_running();
+    vm_stop(RUN_STATE_SAVE_VM);
+
+    qemu_gettimeofday(&tv);
+    savevm_set_time(&s->sn, &tv);
+
+    qemu_savevm_state_complete(s->file);
+    ret = qemu_file_get_error(s->file);
+    vm_state_size = qemu_ftell(s->file);
+    qemu_fclose(s->file);
+
+    if (ret < 0) {
+        qemu_savevm_state_cancel();
+        error_report("Error while writing VM state: %s", strerror(-ret));
+    } else {
+        savevm_create_snapshots(s->bs, &s->sn, vm_state_size);
+    }
+
+    if (saved_vm_running) {
+        vm_start();
+    }
+    savevm_live_cleanup(s);
+}
+
+static void savevm_live_timer(void *opaque)
+{
+    SaveVMLiveState *s = opaque;
+    int64_t now;
+    uint64_t pending;
+    int ret;
+
+    qemu_mutex_unlock_iothread();
+    pending = qemu_savevm_state_pending(s->file, s->max_size);
+    qemu_mutex_lock_iothread();
+
+    if (!pending || pending < s->max_size) {
+        savevm_live_complete(s);
+        return;
+    }
+
+    ret = qemu_savevm_state_iterate(s->file);
+    if (ret >= 0) {
+        ret = qemu_file_get_error(s->file);
+    }
+    if (ret < 0) {
+        error_report("Error while writing VM state: %s", strerror(-ret));
+        qemu_savevm_state_cancel();
+        qemu_fclose(s->file);
+        savevm_live_cleanup(s);
+        return;
+    }
+
+    now = qemu_get_clock_ms(rt_clock);
+    if (now >= s->sample_time + SAVEVM_LIVE_DELAY) {
+        uint64_t bytes = qemu_ftell(s->file) - s->sample_bytes;
+        double bandwidth = (double)bytes / (now - s->sample_time);
+
+        s->max_size = bandwidth * migrate_max_downtime() / 1000000;
+        s->sample_time = now;
+        s->sample_bytes = qemu_ftell(s->file);
+    }
+
+    /* ram_save_iterate() stops after about 50 ms; let the main loop run */
+    qemu_mod_timer(s->timer, now);
+}
+
+/* Called before old snapshots are deleted, so that a refused live save
+   leaves them alone.  */
+static int savevm_live_check(Monitor *mon, BlockDriverState *bs)
+{
+    Error *local_err = NULL;
+
+    if (migration_is_active(migrate_get_current())) {
+        monitor_printf(mon, "Migration is in progress\n");
+        return -EBUSY;
+    }
+    if (migration_is_blocked(&local_err)) {
+        monitor_printf(mon, "%s\n", error_get_pretty(local_err));
+        error_free(local_err);
+        return -EBUSY;
+    }
+    if (bdrv_in_use(bs)) {
+        monitor_printf(mon, "Device '%s' is in use\n",
+                       bdrv_get_device_name(bs));
+        return -EBUSY;
+    }
+    return 0;
+}
+
+static void savevm_live_start(Monitor *mon, BlockDriverState *bs,
+                              QEMUSnapshotInfo *sn)
+{
+    SaveVMLiveState *s;
+    MigrationParams params = {
+        .blk = 0,
+        .shared = 0
+    };
+
+    s = g_malloc0(sizeof(*s));
+    s->file = qemu_fopen_bdrv(bs, 1);
+    if (!s->file) {
+        monitor_printf(mon, "Could not open VM state file\n");
+        g_free(s);
+        return;
+    }
+    s->bs = bs;
+    s->sn = *sn;
+    /* the VM state is written to bs until the snapshot is taken; keep the
+       drive from being removed, changed or resized under us */
+    bdrv_set_in_use(bs, 1);
+    s->timer = qemu_new_timer_ms(rt_clock, savevm_live_timer, s);
+    error_setg(&s->blocker, "A live snapshot is being saved");
+    migrate_add_blocker(s->blocker);
+    savevm_live = s;
+
+    qemu_mutex_unlock_iothread();
+    qemu_savevm_state_begin(s->file, &params);
+    qemu_mutex_lock_iothread();
+
+    s->sample_time = qemu_get_clock_ms(rt_clock);
+    s->sample_bytes = qemu_ftell(s->file);
+    qemu_mod_timer(s->timer, s->sample_time);
+
+    monitor_printf(mon, "Saving snapshot '%s' in the background\n",
+                   sn->name);
+}
+
 void do_savevm(Monitor *mon, const QDict *qdict)
 {
-    BlockDriverState *bs, *bs1;
-    QEMUSnapshotInfo sn1, *sn = &sn1, old_sn1, *old_sn = &old_sn1;
+    BlockDriverState *bs;
+    QEMUSnapshotInfo sn1, *sn = &sn1;
     int ret;
     QEMUFile *f;
     int saved_vm_running;
     uint64_t vm_state_size;
     qemu_timeval tv;
-    struct tm tm;
     const char *name = qdict_get_try_str(qdict, "name");
+    bool live = qdict_get_try_bool(qdict, "live", 0);
     Error *local_err = NULL;
 
+    if (savevm_live) {
+        monitor_printf(mon, "A live snapshot is already being saved\n");
+        return;
+    }
+
     /* Verify if there is a device that doesn't support snapshots and is writable */
     bs = NULL;
     while ((bs = bdrv_next(bs))) {
@@ -2627,36 +3044,32 @@ void do_savevm(Monitor *mon, const QDict *qdict)
         return;
     }
 
+    if (live && savevm_live_check(mon, bs) < 0) {
+        return;
+    }
+
     saved_vm_running = runstate_is_running();
-    vm_stop(RUN_STATE_SAVE_VM);
+    if (!live) {
+        vm_stop(RUN_STATE_SAVE_VM);
+    }
 
     memset(sn, 0, sizeof(*sn));
 
     /* fill auxiliary fields */
     qemu_gettimeofday(&tv);
-    sn->date_sec = tv.tv_sec;
-    sn->date_nsec = tv.tv_usec * 1000;
-    sn->vm_clock_nsec = qemu_get_clock_ns(vm_clock);
-
-    if (name) {
-        ret = bdrv_snapshot_find(bs, old_sn, name);
-        if (ret >= 0) {
-            pstrcpy(sn->name, sizeof(sn->name), old_sn->name);
-            pstrcpy(sn->id_str, sizeof(sn->id_str), old_sn->id_str);
-        } else {
-            pstrcpy(sn->name, sizeof(sn->name), name);
-        }
-    } else {
-        /* cast below needed for OpenBSD where tv_sec is still 'long' */
-        localtime_r((const time_t *)&tv.tv_sec, &tm);
-        strftime(sn->name, sizeof(sn->name), "vm-%Y%m%d%H%M%S", &tm);
-    }
+    savevm_set_time(sn, &tv);
+    savevm_set_name(bs, sn, name, &tv);
 
     /* Delete old snapshots of the same name */
     if (name && del_existing_snapshots(mon, name) < 0) {
         goto the_end;
     }
 
+    if (live) {
+        savevm_live_start(mon, bs, sn);
+        return;
+    }
+
     /* save the VM state */
     f = qemu_fopen_bdrv(bs, 1);
     if (!f) {
@@ -2673,19 +3086,7 @@ void do_savevm(Monitor *mon, const QDict *qdict)
     }
 
     /* create the snapshots */
-
-    bs1 = NULL;
-    while ((bs1 = bdrv_next(bs1))) {
-        if (bdrv_can_snapshot(bs1)) {
-            /* Write VM state size only to the image that contains the state */
-            sn->vm_state_size = (bs == bs1 ? vm_state_size : 0);
-            ret = bdrv_snapshot_create(bs1, sn);
-            if (ret < 0) {
-                monitor_printf(mon, "Error while creating snapshot on '%s'\n",
-                               bdrv_get_device_name(bs1));
-            }
-        }
-    }
+    savevm_create_snapshots(bs, sn, vm_state_size);
 
  the_end:
     if (saved_vm_running)
@@ -2724,6 +3125,11 @@ int load_vmstate(const char *name)
     QEMUFile *f;
     int ret;
 
+    if (savevm_live) {
+        error_report("A live snapshot is being saved");
+        return -EBUSY;
+    }
+
     bs_vm_state = find_vmstate_bs();
     if (!bs_vm_state) {
         error_report("No block device supports snapshots");
@@ -0,0 +1,197 @@
+/*
+ * Device statistics in shared memory
+ *
+ * Copyright (c) 2013 the QEMU project contributors
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Periodically copies the block and NIC counters into a file that host
+ * agents can mmap, so that they do not have to poll query-blockstats.
+ */
+
+#include <sys/mman.h>
+
+#include "qemu-common.h"
+#include "qemu/timer.h"
+#include "qemu/atomic.h"
+#include "qemu/notify.h"
+#include "qemu/error-report.h"
+#include "sysemu/sysemu.h"
+#include "sysemu/stats-shm.h"
+#include "block/block_int.h"
+#include "net/net.h"
+
+#define STATS_SHM_DEFAULT_INTERVAL  100     /* ms */
+#define STATS_SHM_DEFAULT_RECORDS   256
+
+typedef struct StatsShm {
+    char *path;
+    StatsShmHeader *hdr;
+    StatsShmRecord *records;
+    size_t size;
+    int64_t interval;
+    uint32_t nr_records;
+    QEMUTimer *timer;
+    Notifier exit_notifier;
+} StatsShm;
+
+static StatsShm stats_shm;
+
+/* Start writing the next record, or return NULL if the file is full.  */
+static StatsShmRecord *stats_shm_begin(StatsShm *s, int type,
+                                       const char *name)
+{
+    StatsShmRecord *r;
+
+    if (s->nr_records == s->hdr->max_records) {
+        return NULL;
+    }
+    r = &s->records[s->nr_records++];
+    atomic_set(&r->seq, r->seq + 1);
+    smp_wmb();
+    r->type = type;
+    pstrcpy(r->name, sizeof(r->name), name);
+    return r;
+}
+
+static void stats_shm_end(StatsShmRecord *r)
+{
+    smp_wmb();
+    atomic_set(&r->seq, r->seq + 1);
+}
+
+static void stats_shm_block(void *opaque, BlockDriverState *bs)
+{
+    StatsShm *s = opaque;
+    StatsShmRecord *r;
+    int i;
+
+    r = stats_shm_begin(s, STATS_SHM_BLOCK, bdrv_get_device_name(bs));
+    if (!r) {
+        return;
+    }
+    for (i = 0; i < STATS_SHM_NDIR; i++) {
+        r->nr_bytes[i] = bs->nr_bytes[i];
+        r->nr_ops[i] = bs->nr_ops[i];
+        r->total_time_ns[i] = bs->total_time_ns[i];
+        r->bps[i] = bs->io_limits.bps[i];
+        r->iops[i] = bs->io_limits.iops[i];
+    }
+    r->queue_depth = bs->throttle_queued;
+    stats_shm_end(r);
+}
+
+static void stats_shm_nic(NICState *nic, void *opaque)
+{
+    StatsShm *s = opaque;
+    StatsShmRecord *r;
+    NetClientState *nc;
+    int i;
+
+    r = stats_shm_begin(s, STATS_SHM_NET, nic->ncs->name);
+    if (!r) {
+        return;
+    }
+    memset(r->nr_bytes, 0, sizeof(r->nr_bytes));
+    memset(r->nr_ops, 0, sizeof(r->nr_ops));
+    for (i = 0; i < MAX(nic->conf->queues, 1); i++) {
+        nc = qemu_get_subqueue(nic, i);
+        r->nr_bytes[STATS_SHM_READ] += nc->rx_bytes;
+        r->nr_bytes[STATS_SHM_WRITE] += nc->tx_bytes;
+        r->nr_ops[STATS_SHM_READ] += nc->rx_packets;
+        r->nr_ops[STATS_SHM_WRITE] += nc->tx_packets;
+    }
+    memset(r->total_time_ns, 0, sizeof(r->total_time_ns));
+    memset(r->bps, 0, sizeof(r->bps));
+    memset(r->iops, 0, sizeof(r->iops));
+    r->queue_depth = 0;
+    stats_shm_end(r);
+}
+
+static void stats_shm_update(void *opaque)
+{
+    StatsShm *s = opaque;
+    int64_t now = qemu_get_clock_ns(rt_clock);
+
+    s->nr_records = 0;
+    bdrv_iterate(stats_shm_block, s);
+    qemu_foreach_nic(stats_shm_nic, s);
+
+    if (s->nr_records != s->hdr->nr_records) {
+        s->hdr->nr_records = s->nr_records;
+        s->hdr->generation++;
+    }
+    s->hdr->update_ns = now;
+
+    qemu_mod_timer(s->timer, now + s->interval * SCALE_MS);
+}
+
+static void stats_shm_exit(Notifier *n, void *data)
+{
+    StatsShm *s = container_of(n, StatsShm, exit_notifier);
+
+    unlink(s->path);
+}
+
+int stats_shm_init(QemuOpts *opts)
+{
+    StatsShm *s = &stats_shm;
+    const char *path = qemu_opt_get(opts, "path");
+    uint64_t records;
+    int fd;
+
+    if (!path) {
+        error_report("stats-shm: path is required");
+        return -1;
+    }
+    if (s->hdr) {
+        error_report("stats-shm: only one file is supported");
+        return -1;
+    }
+    s->interval = qemu_opt_get_number(opts, "interval",
+                                      STATS_SHM_DEFAULT_INTERVAL);
+    records = qemu_opt_get_number(opts, "records", STATS_SHM_DEFAULT_RECORDS);
+    if (s->interval <= 0 || records == 0 || records > 65536) {
+        error_report("stats-shm: invalid interval or records");
+        return -1;
+    }
+
+    s->size = sizeof(StatsShmHeader) + records * sizeof(StatsShmRecord);
+    fd = qemu_open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        error_report("stats-shm: could not open %s: %s",
+                     path, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, s->size) < 0) {
+        error_report("stats-shm: could not resize %s: %s",
+                     path, strerror(errno));
+        qemu_close(fd);
+        return -1;
+    }
+    s->hdr = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    qemu_close(fd);
+    if (s->hdr == MAP_FAILED) {
+        error_report("stats-shm: could not map %s: %s",
+                     path, strerror(errno));
+        s->hdr = NULL;
+        return -1;
+    }
+
+    s->records = (StatsShmRecord *)(s->hdr + 1);
+    s->hdr->header_size = sizeof(StatsShmHeader);
+    s->hdr->record_size = sizeof(StatsShmRecord);
+    s->hdr->max_records = records;
+    s->hdr->version = STATS_SHM_VERSION;
+    smp_wmb();
+    s->hdr->magic = STATS_SHM_MAGIC;
+
+    s->path = g_strdup(path);
+    s->exit_notifier.notify = stats_shm_exit;
+    qemu_add_exit_notifier(&s->exit_notifier);
+
+    s->timer = qemu_new_timer_ns(rt_clock, stats_shm_update, s);
+    qemu_mod_timer(s->timer, qemu_get_clock_ns(rt_clock));
+    return 0;
+}
@@ -673,6 +673,24 @@ static inline void gen_op_st_T1_A0(int idx)
     gen_op_st_v(idx, cpu_T[1], cpu_A0);
 }
 
+/* Locked instructions.  System emulation runs all vCPUs in one thread,
+   so the global lock taken by helper_lock is empty there and the calls
+   are not emitted at all; a locked read-modify-write is then as cheap
+   as the unlocked one.  */
+static inline void gen_lock(void)
+{
+#ifdef CONFIG_USER_ONLY
+    gen_helper_lock();
+#endif
+}
+
+static inline void gen_unlock(void)
+{
+#ifdef CONFIG_USER_ONLY
+    gen_helper_unlock();
+#endif
+}
+
 static inline void gen_jmp_im(target_ulong pc)
 {
     tcg_gen_movi_tl(cpu_tmp0, pc);
@@ -2844,6 +2862,24 @@ static void gen_jmp(DisasContext *s, target_ulong eip)
     gen_jmp_tb(s, eip, 0);
 }
 
+/* Direct jump or call to eip.  A forward jump that stays on the page the
+   TB started on is followed instead of ending the TB, so that the target
+   code is translated and optimized together with the jump (the known
+   cc_op in particular survives).  Only forward jumps are followed, so
+   the guest code of the TB still lies within [tb->pc, tb->pc + size)
+   for SMC detection and translation cannot loop.  */
+static void gen_jmp_direct(DisasContext *s, target_ulong eip)
+{
+    target_ulong pc = s->cs_base + eip;
+
+    if (s->jmp_opt && pc >= s->pc &&
+        (pc & TARGET_PAGE_MASK) == (s->tb->pc & TARGET_PAGE_MASK)) {
+        s->pc = pc;
+        return;
+    }
+    gen_jmp(s, eip);
+}
+
 static inline void gen_ldq_env_A0(int idx, int offset)
 {
     int mem_index = (idx >> 2) - 1;
@@ -3234,6 +3270,77 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0xdf] = AESNI_OP(aeskeygenassist),
 };
 
+/* Expand simple lane-wise MMX/SSE operations inline instead of calling
+   the helper.  Operands are processed one quadword at a time, so this
+   works on any TCG backend.  Return false if B is not handled here.  */
+static bool gen_sse_inline(int b, int is_xmm, int op1_offset, int op2_offset)
+{
+    TCGv_i64 t0, t1;
+    int i, n;
+
+    switch (b) {
+    case 0x54: case 0xdb: /* andps, andpd, pand */
+    case 0x55: case 0xdf: /* andnps, andnpd, pandn */
+    case 0x56: case 0xeb: /* orps, orpd, por */
+    case 0x57: case 0xef: /* xorps, xorpd, pxor */
+    case 0xfc: case 0xfd: case 0xfe: case 0xd4: /* paddb/w/d/q */
+    case 0xf8: case 0xf9: case 0xfa: case 0xfb: /* psubb/w/d/q */
+        break;
+    default:
+        return false;
+    }
+
+    t0 = tcg_temp_new_i64();
+    t1 = tcg_temp_new_i64();
+    n = is_xmm ? 2 : 1;
+    for (i = 0; i < n; i++) {
+        tcg_gen_ld_i64(t0, cpu_env, op1_offset + i * 8);
+        tcg_gen_ld_i64(t1, cpu_env, op2_offset + i * 8);
+        switch (b) {
+        case 0x54: case 0xdb:
+            tcg_gen_and_i64(t0, t0, t1);
+            break;
+        case 0x55: case 0xdf:
+            tcg_gen_andc_i64(t0, t1, t0);
+            break;
+        case 0x56: case 0xeb:
+            tcg_gen_or_i64(t0, t0, t1);
+            break;
+        case 0x57: case 0xef:
+            tcg_gen_xor_i64(t0, t0, t1);
+            break;
+        case 0xfc:
+            tcg_gen_vec_add8_i64(t0, t0, t1);
+            break;
+        case 0xfd:
+            tcg_gen_vec_add16_i64(t0, t0, t1);
+            break;
+        case 0xfe:
+            tcg_gen_vec_add32_i64(t0, t0, t1);
+            break;
+        case 0xd4:
+            tcg_gen_add_i64(t0, t0, t1);
+            break;
+        case 0xf8:
+            tcg_gen_vec_sub8_i64(t0, t0, t1);
+            break;
+        case 0xf9:
+            tcg_gen_vec_sub16_i64(t0, t0, t1);
+            break;
+        case 0xfa:
+            tcg_gen_vec_sub32_i64(t0, t0, t1);
+            break;
+        case 0xfb:
+            tcg_gen_sub_i64(t0, t0, t1);
+            break;
+        }
+        tcg_gen_st_i64(t0, cpu_env, op1_offset + i * 8);
+    }
+    tcg_temp_free_i64(t0);
+    tcg_temp_free_i64(t1);
+    return true;
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -4650,6 +4757,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, cpu_ptr0, cpu_ptr1, cpu_A0);
             break;
         default:
+            if (gen_sse_inline(b, is_xmm, op1_offset, op2_offset)) {
+                break;
+            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -4825,7 +4935,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
 
     /* lock generation */
     if (prefixes & PREFIX_LOCK)
-        gen_helper_lock();
+        gen_lock();
 
     /* now check op code */
  reswitch:
@@ -5892,11 +6002,11 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             gen_op_mov_TN_reg(ot, 0, reg);
             /* for xchg, lock is implicit */
             if (!(prefixes & PREFIX_LOCK))
-                gen_helper_lock();
+                gen_lock();
             gen_op_ld_T1_A0(ot + s->mem_index);
             gen_op_st_T0_A0(ot + s->mem_index);
             if (!(prefixes & PREFIX_LOCK))
-                gen_helper_unlock();
+                gen_unlock();
             gen_op_mov_reg_T1(ot, reg);
         }
         break;
@@ -6816,7 +6926,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
                 tval &= 0xffffffff;
             gen_movtl_T0_im(next_eip);
             gen_push_T0(s);
-            gen_jmp(s, tval);
+            gen_jmp_direct(s, tval);
         }
         break;
     case 0x9a: /* lcall im */
@@ -6843,7 +6953,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             tval &= 0xffff;
         else if(!CODE64(s))
             tval &= 0xffffffff;
-        gen_jmp(s, tval);
+        gen_jmp_direct(s, tval);
         break;
     case 0xea: /* ljmp im */
         {
@@ -6864,7 +6974,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         tval += s->pc - s->cs_base;
         if (s->dflag == 0)
             tval &= 0xffff;
-        gen_jmp(s, tval);
+        gen_jmp_direct(s, tval);
         break;
     case 0x70 ... 0x7f: /* jcc Jb */
         tval = (int8_t)insn_get(env, s, OT_BYTE);
@@ -8169,11 +8279,11 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
     }
     /* lock generation */
     if (s->prefix & PREFIX_LOCK)
-        gen_helper_unlock();
+        gen_unlock();
     return s->pc;
  illegal_op:
     if (s->prefix & PREFIX_LOCK)
-        gen_helper_unlock();
+        gen_unlock();
     /* XXX: ensure that no lock was generated */
     gen_exception(s, EXCP06_ILLOP, pc_start - s->cs_base);
     return s->pc;
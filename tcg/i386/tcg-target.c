@@ -512,6 +512,17 @@ static void tcg_out_modrm_sib_offset(TCGContext *s, int opc, int r, int rm,
     }
 }
 
+/* Emit an N byte nop: "xchg %ax,%ax" with extra operand size prefixes.  */
+static void tcg_out_nopn(TCGContext *s, int n)
+{
+    int i;
+
+    for (i = 1; i < n; i++) {
+        tcg_out8(s, 0x66);
+    }
+    tcg_out8(s, 0x90);
+}
+
 /* A simplification of the above with no index or shift.  */
 static inline void tcg_out_modrm_offset(TCGContext *s, int opc, int r,
                                         int rm, tcg_target_long offset)
@@ -1684,7 +1695,13 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         break;
     case INDEX_op_goto_tb:
         if (s->tb_jmp_offset) {
-            /* direct jump method */
+            /* direct jump method; keep the displacement 4 byte aligned so
+               that it can be repatched with a single atomic store while
+               other threads are executing this TB */
+            int gap = (-(uintptr_t)(s->code_ptr + 1)) & 3;
+            if (gap) {
+                tcg_out_nopn(s, gap);
+            }
             tcg_out8(s, OPC_JMP_long); /* jmp im */
             s->tb_jmp_offset[args[0]] = s->code_ptr - s->code_buf;
             tcg_out32(s, 0);
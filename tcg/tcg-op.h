@@ -2530,6 +2530,90 @@ static inline void tcg_gen_muls2_i64(TCGv_i64 rl, TCGv_i64 rh,
     }
 }
 
+/* Lane-wise add/sub on a 64-bit value holding packed 8, 16 or 32-bit
+   elements.  M has the most significant bit of each lane set; the low
+   bits are computed with the carries masked off at the lane boundary and
+   the top bit of each lane is then fixed up with xor.  */
+static inline void tcg_gen_vec_add_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b,
+                                       TCGv_i64 m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_andc_i64(t1, a, m);
+    tcg_gen_andc_i64(t2, b, m);
+    tcg_gen_xor_i64(t3, a, b);
+    tcg_gen_add_i64(d, t1, t2);
+    tcg_gen_and_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+static inline void tcg_gen_vec_sub_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b,
+                                       TCGv_i64 m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_or_i64(t1, a, m);
+    tcg_gen_andc_i64(t2, b, m);
+    tcg_gen_eqv_i64(t3, a, b);
+    tcg_gen_sub_i64(d, t1, t2);
+    tcg_gen_and_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+static inline void tcg_gen_vec_add8_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(0x8080808080808080ull);
+    tcg_gen_vec_add_i64(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
+static inline void tcg_gen_vec_add16_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(0x8000800080008000ull);
+    tcg_gen_vec_add_i64(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
+static inline void tcg_gen_vec_add32_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(0x8000000080000000ull);
+    tcg_gen_vec_add_i64(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
+static inline void tcg_gen_vec_sub8_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(0x8080808080808080ull);
+    tcg_gen_vec_sub_i64(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
+static inline void tcg_gen_vec_sub16_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(0x8000800080008000ull);
+    tcg_gen_vec_sub_i64(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
+static inline void tcg_gen_vec_sub32_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 m = tcg_const_i64(0x8000000080000000ull);
+    tcg_gen_vec_sub_i64(d, a, b, m);
+    tcg_temp_free_i64(m);
+}
+
 /***************************************/
 /* QEMU specific operations. Their type depend on the QEMU CPU
    type. */
@@ -323,6 +323,18 @@ static void test_hbitmap_reset(TestHBitmapData *data,
     hbitmap_test_set(data, L3 / 2, L3);
 }
 
+static void test_hbitmap_reset_all(TestHBitmapData *data,
+                                   const void *unused)
+{
+    hbitmap_test_init(data, L3 * 2, 0);
+    hbitmap_test_set(data, L1 - 1, L1 + 2);
+    hbitmap_test_set(data, L2, L3);
+    hbitmap_reset_all(data->hb);
+    memset(data->bits, 0, (L3 * 2 / L1) * sizeof(unsigned long));
+    hbitmap_test_check(data, 0);
+    hbitmap_test_set(data, L3 - 1, 2);
+}
+
 static void test_hbitmap_granularity(TestHBitmapData *data,
                                      const void *unused)
 {
@@ -369,6 +381,119 @@ static void test_hbitmap_iter_granularity(TestHBitmapData *data,
     g_assert_cmpint(hbitmap_iter_next(&hbi), <, 0);
 }
 
+static void test_hbitmap_merge(TestHBitmapData *data,
+                              const void *unused)
+{
+    HBitmap *b;
+    uint64_t i;
+
+    hbitmap_test_init(data, L3, 0);
+    hbitmap_test_set(data, L1 - 1, L1 + 2);
+    hbitmap_test_set(data, L2, L1);
+
+    b = hbitmap_alloc(L3, 0);
+    hbitmap_set(b, 0, L1);
+    hbitmap_set(b, L2 + L1 / 2, L2);
+    g_assert(hbitmap_merge(data->hb, b));
+    hbitmap_free(b);
+
+    for (i = 0; i < L1; i++) {
+        data->bits[i >> LOG_BITS_PER_LONG] |= 1UL << (i & (BITS_PER_LONG - 1));
+    }
+    for (i = L2 + L1 / 2; i < L2 * 2 + L1 / 2; i++) {
+        data->bits[i >> LOG_BITS_PER_LONG] |= 1UL << (i & (BITS_PER_LONG - 1));
+    }
+    hbitmap_test_check(data, 0);
+
+    /* Bitmaps of different sizes are not merged.  */
+    b = hbitmap_alloc(L2, 0);
+    hbitmap_set(b, 0, L2);
+    g_assert(!hbitmap_merge(data->hb, b));
+    hbitmap_free(b);
+    hbitmap_test_check(data, 0);
+}
+
+static void test_hbitmap_serialize(TestHBitmapData *data,
+                                   const void *unused)
+{
+    HBitmap *hb;
+    uint8_t *buf;
+    uint64_t size, half;
+
+    hbitmap_test_init(data, L3 + 23, 0);
+    hbitmap_test_set(data, 0, 1);
+    hbitmap_test_set(data, L1 * 3 - 1, L2);
+    hbitmap_test_set(data, L3 + 22, 1);
+
+    size = hbitmap_serialization_size(data->hb, 0, L3 + 23);
+    g_assert_cmpint(size, ==, ((L3 + 23 + 63) / 64) * sizeof(uint64_t));
+    buf = g_malloc0(size);
+    hbitmap_serialize_part(data->hb, buf, 0, L3 + 23);
+    g_assert_cmpint(buf[0], ==, 1);
+
+    /* Load the image back in two parts.  */
+    hbitmap_free(data->hb);
+    data->hb = hb = hbitmap_alloc(L3 + 23, 0);
+    half = L3 / 2;
+    g_assert_cmpint(half % hbitmap_serialization_granularity(hb), ==, 0);
+    hbitmap_deserialize_part(hb, buf, 0, half, false);
+    hbitmap_deserialize_part(hb, buf + hbitmap_serialization_size(hb, 0, half),
+                             half, L3 + 23 - half, true);
+    g_free(buf);
+
+    hbitmap_test_check(data, 0);
+    hbitmap_test_check_get(data);
+}
+
+static void perf_hbitmap_set_reset(void)
+{
+    HBitmap *hb;
+    unsigned int i, max;
+    double duration;
+
+    max = 100000;
+    hb = hbitmap_alloc(L3 * 4, 0);
+
+    g_test_timer_start();
+    for (i = 0; i < max; i++) {
+        hbitmap_set(hb, (i * 7919) % (L3 * 3), L2);
+        hbitmap_reset(hb, (i * 104729) % (L3 * 3), L2);
+    }
+    duration = g_test_timer_elapsed();
+    hbitmap_free(hb);
+
+    g_test_message("Set/reset %u ranges of %u bits: %f s\n",
+                   max, (unsigned)L2, duration);
+}
+
+static void perf_hbitmap_iter(void)
+{
+    HBitmap *hb;
+    HBitmapIter hbi;
+    unsigned int i, max;
+    uint64_t visited = 0;
+    double duration;
+
+    max = 100;
+    hb = hbitmap_alloc(L3 * 4, 0);
+    for (i = 0; i < L3 * 4; i += L1 * 3 + 1) {
+        hbitmap_set(hb, i, 1);
+    }
+
+    g_test_timer_start();
+    for (i = 0; i < max; i++) {
+        hbitmap_iter_init(&hbi, hb, 0);
+        while (hbitmap_iter_next(&hbi) >= 0) {
+            visited++;
+        }
+    }
+    duration = g_test_timer_elapsed();
+    hbitmap_free(hb);
+
+    g_test_message("Iterate %u times over %" PRIu64 " sparse bits: %f s\n",
+                   max, visited / max, duration);
+}
+
 static void hbitmap_test_add(const char *testpath,
                                    void (*test_func)(TestHBitmapData *data, const void *user_data))
 {
@@ -394,7 +519,14 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/set/overlap", test_hbitmap_set_overlap);
     hbitmap_test_add("/hbitmap/reset/empty", test_hbitmap_reset_empty);
     hbitmap_test_add("/hbitmap/reset/general", test_hbitmap_reset);
+    hbitmap_test_add("/hbitmap/reset/all", test_hbitmap_reset_all);
     hbitmap_test_add("/hbitmap/granularity", test_hbitmap_granularity);
+    hbitmap_test_add("/hbitmap/merge", test_hbitmap_merge);
+    hbitmap_test_add("/hbitmap/serialize", test_hbitmap_serialize);
+    if (g_test_perf()) {
+        g_test_add_func("/perf/hbitmap/set-reset", perf_hbitmap_set_reset);
+        g_test_add_func("/perf/hbitmap/iter", perf_hbitmap_iter);
+    }
     g_test_run();
 
     return 0;
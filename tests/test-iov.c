@@ -398,6 +398,38 @@ static void test_discard_back(void)
     iov_free(iov, iov_cnt);
 }
 
+static void test_qiov_grow(void)
+{
+    QEMUIOVector qiov;
+    char buf[QEMU_IOVEC_INLINE * 4];
+    int i;
+
+    /* Small vectors use the inline storage... */
+    qemu_iovec_init(&qiov, 1);
+    g_assert(qiov.iov == qiov.inline_iov);
+    for (i = 0; i < QEMU_IOVEC_INLINE; i++) {
+        qemu_iovec_add(&qiov, &buf[i], 1);
+    }
+    g_assert(qiov.iov == qiov.inline_iov);
+
+    /* ... and move to the heap when they grow, keeping their contents.  */
+    for (; i < QEMU_IOVEC_INLINE * 4; i++) {
+        qemu_iovec_add(&qiov, &buf[i], 1);
+    }
+    g_assert(qiov.iov != qiov.inline_iov);
+    g_assert_cmpint(qiov.niov, ==, QEMU_IOVEC_INLINE * 4);
+    g_assert_cmpint(qiov.size, ==, QEMU_IOVEC_INLINE * 4);
+    for (i = 0; i < QEMU_IOVEC_INLINE * 4; i++) {
+        g_assert(qiov.iov[i].iov_base == &buf[i]);
+    }
+    qemu_iovec_destroy(&qiov);
+
+    /* Large hints allocate up front.  */
+    qemu_iovec_init(&qiov, QEMU_IOVEC_INLINE + 1);
+    g_assert(qiov.iov != qiov.inline_iov);
+    qemu_iovec_destroy(&qiov);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -406,5 +438,6 @@ int main(int argc, char **argv)
     g_test_add_func("/basic/iov/io", test_io);
     g_test_add_func("/basic/iov/discard-front", test_discard_front);
     g_test_add_func("/basic/iov/discard-back", test_discard_back);
+    g_test_add_func("/basic/iov/qiov-grow", test_qiov_grow);
     return g_test_run();
 }
@@ -77,7 +77,11 @@ typedef struct PageDesc {
     /* list of TBs intersecting this ram page */
     TranslationBlock *first_tb;
     /* in order to optimize self modifying code, we count the number
-       of lookups we do to a given page to use a bitmap */
+       of lookups we do to a given page to use a bitmap.  The count is
+       kept when the bitmap is dropped, so that a page which mixes code
+       and data gets its bitmap back on the next write.  The bitmap may
+       have stale bits for TBs that were invalidated; it is rebuilt when
+       a write hits one of them.  */
     unsigned int code_write_count;
     uint8_t *code_bitmap;
 #if defined(CONFIG_USER_ONLY)
@@ -122,6 +126,9 @@ static void *l1_map[V_L1_SIZE];
 /* code generation context */
 TCGContext tcg_ctx;
 
+/* perf-<pid>.map, see tb_perf_map_enable() */
+static FILE *perf_map_file;
+
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2);
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr);
@@ -488,6 +495,21 @@ static inline size_t size_code_gen_buffer(size_t tb_size)
            static buffer, we could size this on RESERVED_VA, on the text
            segment size of the executable, or continue to use the default.  */
         tb_size = (unsigned long)(ram_size / 4);
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+        {
+            /* but do not let a large guest take a big share of the host */
+            long pages = sysconf(_SC_PHYS_PAGES);
+            long page_size = sysconf(_SC_PAGESIZE);
+
+            if (pages > 0 && page_size > 0 &&
+                tb_size > (uint64_t)pages * page_size / 8) {
+                tb_size = (uint64_t)pages * page_size / 8;
+            }
+        }
+#endif
+        if (tb_size < DEFAULT_CODE_GEN_BUFFER_SIZE) {
+            tb_size = DEFAULT_CODE_GEN_BUFFER_SIZE;
+        }
 #endif
     }
     if (tb_size < MIN_CODE_GEN_BUFFER_SIZE) {
@@ -605,20 +627,79 @@ bool tcg_enabled(void)
     return tcg_ctx.code_gen_buffer != NULL;
 }
 
-/* Allocate a new translation block. Flush the translation buffer if
-   too many translation blocks or too much generated code. */
+/* i-th live translation block, oldest first */
+static inline TranslationBlock *tb_ring(int i)
+{
+    return &tcg_ctx.tb_ctx.tbs[(tcg_ctx.tb_ctx.tb_tail + i) %
+                               tcg_ctx.code_gen_max_blocks];
+}
+
+/* Free space ahead of code_gen_ptr.  Generated code is used as a ring:
+   once code_gen_ptr has wrapped it stays below the code of the oldest
+   TB.  */
+static size_t tb_code_space(void)
+{
+    uint8_t *tail;
+
+    if (tcg_ctx.tb_ctx.nb_tbs == 0) {
+        tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
+        return tcg_ctx.code_gen_buffer_size;
+    }
+    tail = tb_ring(0)->tc_ptr;
+    if (tail < tcg_ctx.code_gen_ptr) {
+        return tcg_ctx.code_gen_buffer + tcg_ctx.code_gen_buffer_size -
+            tcg_ctx.code_gen_ptr;
+    }
+    return tail - tcg_ctx.code_gen_ptr;
+}
+
+/* Drop the oldest translation block to make room.  */
+static void tb_evict_oldest(void)
+{
+    TranslationBlock *tb = tb_ring(0);
+
+    tb_phys_invalidate(tb, -1);
+    /* the slot and its code are about to be reused, so even an already
+       invalidated TB must not be patched by cpu_exec any more; this also
+       tells lockless jump cache readers that the slot may change under
+       them, which is why it comes after tb_phys_invalidate cleared the
+       jump caches */
+    atomic_inc(&tcg_ctx.tb_ctx.tb_invalidated_gen);
+    tcg_ctx.tb_ctx.tb_tail = (tcg_ctx.tb_ctx.tb_tail + 1) %
+        tcg_ctx.code_gen_max_blocks;
+    tcg_ctx.tb_ctx.nb_tbs--;
+    tcg_ctx.tb_ctx.tb_evict_count++;
+}
+
+/* Allocate a new translation block.  When too many translation blocks
+   or too much generated code are live, the oldest blocks are evicted
+   instead of flushing the whole buffer, so that the rest of the working
+   set survives.  */
 static TranslationBlock *tb_alloc(target_ulong pc)
 {
     TranslationBlock *tb;
+    size_t min_space = tcg_ctx.code_gen_buffer_size -
+        tcg_ctx.code_gen_buffer_max_size;
 
-    if (tcg_ctx.tb_ctx.nb_tbs >= tcg_ctx.code_gen_max_blocks ||
-        (tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer) >=
-         tcg_ctx.code_gen_buffer_max_size) {
-        return NULL;
+    while (tcg_ctx.tb_ctx.nb_tbs >= tcg_ctx.code_gen_max_blocks) {
+        tb_evict_oldest();
+    }
+    while (tb_code_space() < min_space) {
+        if (tb_ring(0)->tc_ptr < tcg_ctx.code_gen_ptr) {
+            /* no room at the end of the buffer, start again at the
+               beginning */
+            tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
+        } else {
+            tb_evict_oldest();
+        }
     }
-    tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
+    tb = tb_ring(tcg_ctx.tb_ctx.nb_tbs++);
     tb->pc = pc;
     tb->cflags = 0;
+    tb->invalid = 0;
+#ifdef CONFIG_PROFILER
+    tb->exec_count = 0;
+#endif
     return tb;
 }
 
@@ -628,7 +709,7 @@ void tb_free(TranslationBlock *tb)
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
     if (tcg_ctx.tb_ctx.nb_tbs > 0 &&
-            tb == &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs - 1]) {
+            tb == tb_ring(tcg_ctx.tb_ctx.nb_tbs - 1)) {
         tcg_ctx.code_gen_ptr = tb->tc_ptr;
         tcg_ctx.tb_ctx.nb_tbs--;
     }
@@ -640,7 +721,6 @@ static inline void invalidate_page_bitmap(PageDesc *p)
         g_free(p->code_bitmap);
         p->code_bitmap = NULL;
     }
-    p->code_write_count = 0;
 }
 
 /* Set to NULL all the 'first_tb' fields in all PageDescs. */
@@ -657,6 +737,7 @@ static void page_flush_tb_1(int level, void **lp)
         for (i = 0; i < L2_SIZE; ++i) {
             pd[i].first_tb = NULL;
             invalidate_page_bitmap(pd + i);
+            pd[i].code_write_count = 0;
         }
     } else {
         void **pp = *lp;
@@ -694,10 +775,13 @@ void tb_flush(CPUArchState *env1)
         cpu_abort(env1, "Internal error: code buffer overflow\n");
     }
     tcg_ctx.tb_ctx.nb_tbs = 0;
+    tcg_ctx.tb_ctx.tb_tail = 0;
 
     for (env = first_cpu; env != NULL; env = env->next_cpu) {
         memset(env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof(void *));
     }
+    /* after clearing the jump caches, see tb_find_fast */
+    atomic_inc(&tcg_ctx.tb_ctx.tb_invalidated_gen);
 
     memset(tcg_ctx.tb_ctx.tb_phys_hash, 0,
             CODE_GEN_PHYS_HASH_SIZE * sizeof(void *));
@@ -826,6 +910,11 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     tb_page_addr_t phys_pc;
     TranslationBlock *tb1, *tb2;
 
+    if (tb->invalid) {
+        return;
+    }
+    tb->invalid = 1;
+
     /* remove the TB from the hash list */
     phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
     h = tb_phys_hash_func(phys_pc);
@@ -835,15 +924,13 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     if (tb->page_addr[0] != page_addr) {
         p = page_find(tb->page_addr[0] >> TARGET_PAGE_BITS);
         tb_page_remove(&p->first_tb, tb);
-        invalidate_page_bitmap(p);
     }
     if (tb->page_addr[1] != -1 && tb->page_addr[1] != page_addr) {
         p = page_find(tb->page_addr[1] >> TARGET_PAGE_BITS);
         tb_page_remove(&p->first_tb, tb);
-        invalidate_page_bitmap(p);
     }
 
-    tcg_ctx.tb_ctx.tb_invalidated_flag = 1;
+    atomic_inc(&tcg_ctx.tb_ctx.tb_invalidated_gen);
 
     /* remove the TB from the hash list */
     h = tb_jmp_cache_hash_func(tb->pc);
@@ -902,35 +989,65 @@ static inline void set_bits(uint8_t *tab, int start, int len)
     }
 }
 
+/* mark the bytes of page n of tb in the code bitmap of p */
+static void page_bitmap_add_tb(PageDesc *p, TranslationBlock *tb, int n)
+{
+    int tb_start, tb_end;
+
+    /* NOTE: this is subtle as a TB may span two physical pages */
+    if (n == 0) {
+        /* NOTE: tb_end may be after the end of the page, but
+           it is not a problem */
+        tb_start = tb->pc & ~TARGET_PAGE_MASK;
+        tb_end = tb_start + tb->size;
+        if (tb_end > TARGET_PAGE_SIZE) {
+            tb_end = TARGET_PAGE_SIZE;
+        }
+    } else {
+        tb_start = 0;
+        tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
+    }
+    set_bits(p->code_bitmap, tb_start, tb_end - tb_start);
+}
+
 static void build_page_bitmap(PageDesc *p)
 {
-    int n, tb_start, tb_end;
+    int n;
     TranslationBlock *tb;
 
-    p->code_bitmap = g_malloc0(TARGET_PAGE_SIZE / 8);
+    if (p->code_bitmap) {
+        memset(p->code_bitmap, 0, TARGET_PAGE_SIZE / 8);
+    } else {
+        p->code_bitmap = g_malloc0(TARGET_PAGE_SIZE / 8);
+    }
 
     tb = p->first_tb;
     while (tb != NULL) {
         n = (uintptr_t)tb & 3;
         tb = (TranslationBlock *)((uintptr_t)tb & ~3);
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        if (n == 0) {
-            /* NOTE: tb_end may be after the end of the page, but
-               it is not a problem */
-            tb_start = tb->pc & ~TARGET_PAGE_MASK;
-            tb_end = tb_start + tb->size;
-            if (tb_end > TARGET_PAGE_SIZE) {
-                tb_end = TARGET_PAGE_SIZE;
-            }
-        } else {
-            tb_start = 0;
-            tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
-        }
-        set_bits(p->code_bitmap, tb_start, tb_end - tb_start);
+        page_bitmap_add_tb(p, tb, n);
         tb = tb->page_next[n];
     }
 }
 
+/* Write a perf-<pid>.map file describing each translated block, so
+   that "perf report" can attribute samples in code_gen_buffer to guest
+   addresses.  Blocks are not removed from the map when the buffer
+   space is reused; perf uses the most recent entry.  */
+void tb_perf_map_enable(void)
+{
+    char name[64];
+
+    snprintf(name, sizeof(name), "/tmp/perf-%d.map", getpid());
+    perf_map_file = fopen(name, "w");
+    if (!perf_map_file) {
+        fprintf(stderr, "qemu: could not open %s: %s\n",
+                name, strerror(errno));
+        return;
+    }
+    setvbuf(perf_map_file, NULL, _IOLBF, 0);
+}
+
 TranslationBlock *tb_gen_code(CPUArchState *env,
                               target_ulong pc, target_ulong cs_base,
                               int flags, int cflags)
@@ -942,21 +1059,18 @@ TranslationBlock *tb_gen_code(CPUArchState *env,
     int code_gen_size;
 
     phys_pc = get_page_addr_code(env, pc);
+    /* may evict old TBs, which bumps tb_invalidated_gen */
     tb = tb_alloc(pc);
-    if (!tb) {
-        /* flush must be done */
-        tb_flush(env);
-        /* cannot fail at this point */
-        tb = tb_alloc(pc);
-        /* Don't forget to invalidate previous TB info.  */
-        tcg_ctx.tb_ctx.tb_invalidated_flag = 1;
-    }
     tc_ptr = tcg_ctx.code_gen_ptr;
     tb->tc_ptr = tc_ptr;
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
     cpu_gen_code(env, tb, &code_gen_size);
+    if (perf_map_file) {
+        fprintf(perf_map_file, "%" PRIxPTR " %x guest-" TARGET_FMT_lx "\n",
+                (uintptr_t)tc_ptr, code_gen_size, pc);
+    }
     tcg_ctx.code_gen_ptr = (void *)(((uintptr_t)tcg_ctx.code_gen_ptr +
             code_gen_size + CODE_GEN_ALIGN - 1) & ~(CODE_GEN_ALIGN - 1));
 
@@ -1002,7 +1116,7 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
     CPUState *cpu = NULL;
     tb_page_addr_t tb_start, tb_end;
     PageDesc *p;
-    int n;
+    int n, hit = 0;
 #ifdef TARGET_HAS_PRECISE_SMC
     int current_tb_not_found = is_cpu_write_access;
     TranslationBlock *current_tb = NULL;
@@ -1016,11 +1130,14 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
     if (!p) {
         return;
     }
-    if (!p->code_bitmap &&
-        ++p->code_write_count >= SMC_BITMAP_USE_THRESHOLD &&
-        is_cpu_write_access) {
-        /* build code bitmap */
-        build_page_bitmap(p);
+    if (!p->code_bitmap && is_cpu_write_access) {
+        if (p->code_write_count < SMC_BITMAP_USE_THRESHOLD) {
+            p->code_write_count++;
+        }
+        if (p->code_write_count >= SMC_BITMAP_USE_THRESHOLD) {
+            /* build code bitmap */
+            build_page_bitmap(p);
+        }
     }
     if (env != NULL) {
         cpu = ENV_GET_CPU(env);
@@ -1045,6 +1162,7 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
             tb_end = tb_start + ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
         }
         if (!(tb_end <= start || tb_start >= end)) {
+            hit = 1;
 #ifdef TARGET_HAS_PRECISE_SMC
             if (current_tb_not_found) {
                 current_tb_not_found = 0;
@@ -1085,6 +1203,11 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
         }
         tb = tb_next;
     }
+    if (!hit && p->code_bitmap && is_cpu_write_access) {
+        /* the write only hit stale bits of invalidated TBs: drop them
+           so that further writes to this data take the fast path */
+        build_page_bitmap(p);
+    }
 #if !defined(CONFIG_USER_ONLY)
     /* if no code remaining, no need to continue to use slow writes */
     if (!p->first_tb) {
@@ -1219,7 +1342,9 @@ static inline void tb_alloc_page(TranslationBlock *tb,
     page_already_protected = p->first_tb != NULL;
 #endif
     p->first_tb = (TranslationBlock *)((uintptr_t)tb | n);
-    invalidate_page_bitmap(p);
+    if (p->code_bitmap) {
+        page_bitmap_add_tb(p, tb, n);
+    }
 
 #if defined(TARGET_HAS_SMC) || 1
 
@@ -1319,17 +1444,32 @@ bool is_tcg_gen_code(uintptr_t tc_ptr)
 
 /* find the TB 'tb' such that tb[0].tc_ptr <= tc_ptr <
    tb[1].tc_ptr. Return NULL if not found */
+/* distance of a code pointer from the oldest TB, in ring order */
+static inline uintptr_t tb_code_age(uintptr_t tail, uintptr_t ptr)
+{
+    if (ptr >= tail) {
+        return ptr - tail;
+    }
+    return ptr + tcg_ctx.code_gen_buffer_size - tail;
+}
+
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
 {
     int m_min, m_max, m;
-    uintptr_t v;
+    uintptr_t v, tail, key;
     TranslationBlock *tb;
 
     if (tcg_ctx.tb_ctx.nb_tbs <= 0) {
         return NULL;
     }
     if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer ||
-        tc_ptr >= (uintptr_t)tcg_ctx.code_gen_ptr) {
+        tc_ptr >= (uintptr_t)(tcg_ctx.code_gen_buffer +
+                              tcg_ctx.code_gen_buffer_size)) {
+        return NULL;
+    }
+    tail = (uintptr_t)tb_ring(0)->tc_ptr;
+    key = tb_code_age(tail, tc_ptr);
+    if (key >= tb_code_age(tail, (uintptr_t)tcg_ctx.code_gen_ptr)) {
         return NULL;
     }
     /* binary search (cf Knuth) */
@@ -1337,17 +1477,17 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
     m_max = tcg_ctx.tb_ctx.nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
-        tb = &tcg_ctx.tb_ctx.tbs[m];
-        v = (uintptr_t)tb->tc_ptr;
-        if (v == tc_ptr) {
+        tb = tb_ring(m);
+        v = tb_code_age(tail, (uintptr_t)tb->tc_ptr);
+        if (v == key) {
             return tb;
-        } else if (tc_ptr < v) {
+        } else if (key < v) {
             m_max = m - 1;
         } else {
             m_min = m + 1;
         }
     }
-    return &tcg_ctx.tb_ctx.tbs[m_max];
+    return tb_ring(m_max);
 }
 
 #if defined(TARGET_HAS_ICE) && !defined(CONFIG_USER_ONLY)
@@ -1488,10 +1628,46 @@ void tb_flush_jmp_cache(CPUArchState *env, target_ulong addr)
            TB_JMP_PAGE_SIZE * sizeof(TranslationBlock *));
 }
 
+#ifdef CONFIG_PROFILER
+#define HOT_TB_COUNT 10
+
+static void dump_hot_tbs(FILE *f, fprintf_function cpu_fprintf)
+{
+    TranslationBlock *hot[HOT_TB_COUNT], *tb;
+    int i, j, n = 0;
+
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
+        tb = tb_ring(i);
+        if (tb->invalid || tb->exec_count == 0) {
+            continue;
+        }
+        /* insertion into a short array sorted by decreasing count */
+        for (j = n; j > 0 && hot[j - 1]->exec_count < tb->exec_count; j--) {
+            if (j < HOT_TB_COUNT) {
+                hot[j] = hot[j - 1];
+            }
+        }
+        if (j < HOT_TB_COUNT) {
+            hot[j] = tb;
+            if (n < HOT_TB_COUNT) {
+                n++;
+            }
+        }
+    }
+    cpu_fprintf(f, "\nHottest TBs (lookups by cpu_exec):\n");
+    for (i = 0; i < n; i++) {
+        cpu_fprintf(f, "  pc " TARGET_FMT_lx " host %p size %d  %" PRIu64
+                    "\n", hot[i]->pc, hot[i]->tc_ptr, hot[i]->size,
+                    hot[i]->exec_count);
+    }
+}
+#endif
+
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
     int i, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    ptrdiff_t code_size;
     TranslationBlock *tb;
 
     target_code_size = 0;
@@ -1500,7 +1676,7 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
     for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
-        tb = &tcg_ctx.tb_ctx.tbs[i];
+        tb = tb_ring(i);
         target_code_size += tb->size;
         if (tb->size > max_target_code_size) {
             max_target_code_size = tb->size;
@@ -1515,11 +1691,13 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
             }
         }
     }
+    code_size = tcg_ctx.tb_ctx.nb_tbs ?
+        tb_code_age((uintptr_t)tb_ring(0)->tc_ptr,
+                    (uintptr_t)tcg_ctx.code_gen_ptr) : 0;
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
     cpu_fprintf(f, "gen code size       %td/%zd\n",
-                tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
-                tcg_ctx.code_gen_buffer_max_size);
+                code_size, tcg_ctx.code_gen_buffer_max_size);
     cpu_fprintf(f, "TB count            %d/%d\n",
             tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.code_gen_max_blocks);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
@@ -1527,12 +1705,8 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                     tcg_ctx.tb_ctx.nb_tbs : 0,
             max_target_code_size);
     cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-            tcg_ctx.tb_ctx.nb_tbs ? (tcg_ctx.code_gen_ptr -
-                                     tcg_ctx.code_gen_buffer) /
-                                     tcg_ctx.tb_ctx.nb_tbs : 0,
-                target_code_size ? (double) (tcg_ctx.code_gen_ptr -
-                                             tcg_ctx.code_gen_buffer) /
-                                             target_code_size : 0);
+            tcg_ctx.tb_ctx.nb_tbs ? code_size / tcg_ctx.tb_ctx.nb_tbs : 0,
+            target_code_size ? (double) code_size / target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
             tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
                                     tcg_ctx.tb_ctx.nb_tbs : 0);
@@ -1545,9 +1719,15 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                         tcg_ctx.tb_ctx.nb_tbs : 0);
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %d\n", tcg_ctx.tb_ctx.tb_flush_count);
+    cpu_fprintf(f, "TB evict count      %d\n", tcg_ctx.tb_ctx.tb_evict_count);
     cpu_fprintf(f, "TB invalidate count %d\n",
             tcg_ctx.tb_ctx.tb_phys_invalidate_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+    cpu_fprintf(f, "TLB fill count      %d (victim hits %d)\n",
+                tlb_fill_count, tlb_victim_hit_count);
+#ifdef CONFIG_PROFILER
+    dump_hot_tbs(f, cpu_fprintf);
+#endif
     tcg_dump_info(f, cpu_fprintf);
 }
 
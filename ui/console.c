@@ -28,6 +28,14 @@
 #include "qmp-commands.h"
 #include "sysemu/char.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef CONFIG_AVX2_OPT
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 //#define DEBUG_CONSOLE
 #define DEFAULT_BACKSCROLL 512
 #define MAX_CONSOLES 12
@@ -1359,6 +1367,119 @@ void qemu_free_displaysurface(DisplaySurface *surface)
     g_free(surface);
 }
 
+/*
+ * Framebuffer compare-and-copy, used by the display frontends to turn
+ * coarse dirty information into real changes: @len bytes of @src are
+ * compared with @dst and copied over it in the same pass.  Only chunks
+ * that differ are stored, so unchanged lines of the shadow surface stay
+ * clean in the cache.  Returns true if anything differed.
+ */
+static bool dpy_cmp_copy_generic(void *dst, const void *src, size_t len)
+{
+    if (memcmp(dst, src, len) == 0) {
+        return false;
+    }
+    memcpy(dst, src, len);
+    return true;
+}
+
+#ifdef __SSE2__
+static bool dpy_cmp_copy_sse2(void *dst, const void *src, size_t len)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    bool changed = false;
+    size_t i;
+
+    for (i = 0; i + sizeof(__m128i) <= len; i += sizeof(__m128i)) {
+        __m128i vs = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i vd = _mm_loadu_si128((const __m128i *)(d + i));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(vs, vd)) != 0xFFFF) {
+            _mm_storeu_si128((__m128i *)(d + i), vs);
+            changed = true;
+        }
+    }
+    if (i < len) {
+        changed |= dpy_cmp_copy_generic(d + i, s + i, len - i);
+    }
+    return changed;
+}
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+static bool dpy_cmp_copy_avx2(void *dst, const void *src, size_t len)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    bool changed = false;
+    size_t i;
+
+    for (i = 0; i + sizeof(__m256i) <= len; i += sizeof(__m256i)) {
+        __m256i vs = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i vd = _mm256_loadu_si256((const __m256i *)(d + i));
+
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(vs, vd)) != -1) {
+            _mm256_storeu_si256((__m256i *)(d + i), vs);
+            changed = true;
+        }
+    }
+    if (i < len) {
+        changed |= dpy_cmp_copy_generic(d + i, s + i, len - i);
+    }
+    return changed;
+}
+#pragma GCC pop_options
+
+static bool dpy_have_avx2(void)
+{
+    unsigned int a, b, c, d;
+    uint32_t xcr0_lo, xcr0_hi;
+
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE) ||
+        !(c & bit_AVX)) {
+        return false;
+    }
+    /* The OS must save the YMM state for us */
+    asm("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 6) != 6) {
+        return false;
+    }
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return false;
+    }
+    __cpuid_count(7, 0, a, b, c, d);
+    return b & bit_AVX2;
+}
+#endif
+
+static bool dpy_cmp_copy_init(void *dst, const void *src, size_t len);
+
+static bool (*dpy_cmp_copy_fn)(void *dst, const void *src, size_t len) =
+    dpy_cmp_copy_init;
+
+/* Pick the best implementation for the host CPU on first use */
+static bool dpy_cmp_copy_init(void *dst, const void *src, size_t len)
+{
+    dpy_cmp_copy_fn = dpy_cmp_copy_generic;
+#ifdef __SSE2__
+    dpy_cmp_copy_fn = dpy_cmp_copy_sse2;
+#endif
+#ifdef CONFIG_AVX2_OPT
+    if (dpy_have_avx2()) {
+        dpy_cmp_copy_fn = dpy_cmp_copy_avx2;
+    }
+#endif
+    return dpy_cmp_copy_fn(dst, src, len);
+}
+
+bool dpy_cmp_copy(void *dst, const void *src, size_t len)
+{
+    return dpy_cmp_copy_fn(dst, src, len);
+}
+
 void register_displaychangelistener(DisplayChangeListener *dcl)
 {
     static const char nodev[] =
@@ -178,11 +178,9 @@ static void qemu_spice_create_one_update(SimpleSpiceDisplay *ssd,
     image->bitmap.palette = 0;
     image->bitmap.format = SPICE_BITMAP_FMT_32BIT;
 
+    /* The mirror was brought up to date by qemu_spice_create_update() */
     dest = pixman_image_create_bits(PIXMAN_LE_x8r8g8b8, bw, bh,
                                     (void *)update->bitmap, bw * 4);
-    pixman_image_composite(PIXMAN_OP_SRC, ssd->surface, NULL, ssd->mirror,
-                           rect->left, rect->top, 0, 0,
-                           rect->left, rect->top, bw, bh);
     pixman_image_composite(PIXMAN_OP_SRC, ssd->mirror, NULL, dest,
                            rect->left, rect->top, 0, 0,
                            0, 0, bw, bh);
@@ -226,9 +224,9 @@ static void qemu_spice_create_update(SimpleSpiceDisplay *ssd)
             xoff = x * bpp;
             blk = x / blksize;
             bw = MIN(blksize, ssd->dirty.right - x);
-            if (memcmp(guest + yoff1 + xoff,
-                       mirror + yoff2 + xoff,
-                       bw * bpp) == 0) {
+            if (!dpy_cmp_copy(mirror + yoff2 + xoff,
+                              guest + yoff1 + xoff,
+                              bw * bpp)) {
                 if (dirty_top[blk] != -1) {
                     QXLRect update = {
                         .top    = dirty_top[blk],
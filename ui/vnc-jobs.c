@@ -30,6 +30,7 @@
 #include "vnc-jobs.h"
 #include "qemu/sockets.h"
 #include "qemu/main-loop.h"
+#include "qemu/timer.h"
 
 /*
  * Locking:
@@ -42,30 +43,40 @@
  * - VncState::output lock: used to make sure the output buffer is not corrupted
  *                          if two threads try to write on it at the same time
  *
- * While the VNC worker thread is working, the VncDisplay global lock is held
- * to avoid screen corruption (this does not block vnc_refresh() because it
- * uses trylock()) but the output lock is not held because the thread works on
- * its own output buffer.
+ * While a VNC worker thread is working, the VncDisplay lock is held in
+ * shared mode to avoid screen corruption (this does not block vnc_refresh()
+ * because it uses trylock()) but the output lock is not held because the
+ * thread works on its own output buffer.
  * When the encoding job is done, the worker thread will hold the output lock
  * and copy its output buffer in vs->output.
+ *
+ * Jobs are encoded by a small pool of worker threads.  Encoder state (zlib
+ * streams, tight/zrle buffers) is per client, so the jobs of one client are
+ * always encoded in order by one worker at a time; jobs of different clients
+ * are encoded in parallel.
  */
 
+/* Upper bound on encoding threads, started on demand */
+#define VNC_JOBS_MAX_WORKERS 4
+
 struct VncJobQueue {
     QemuCond cond;
     QemuMutex mutex;
-    QemuThread thread;
     bool exit;
+    int nr_threads;     /* worker threads started */
+    int nr_idle;        /* worker threads waiting for a job */
     QTAILQ_HEAD(, VncJob) jobs;
 };
 
 typedef struct VncJobQueue VncJobQueue;
 
 /*
- * We use a single global queue, but most of the functions are
- * already reentrant, so we can easily add more than one encoding thread
+ * We use a single global queue shared by all worker threads
  */
 static VncJobQueue *queue;
 
+static void vnc_start_worker_locked(VncJobQueue *queue);
+
 static void vnc_lock_queue(VncJobQueue *queue)
 {
     qemu_mutex_lock(&queue->mutex);
@@ -102,12 +113,22 @@ int vnc_job_add_rect(VncJob *job, int x, int y, int w, int h)
     return 1;
 }
 
+static bool vnc_has_job_locked(VncState *vs);
+
 void vnc_job_push(VncJob *job)
 {
     vnc_lock_queue(queue);
     if (queue->exit || QLIST_EMPTY(&job->rectangles)) {
         g_free(job);
     } else {
+        /*
+         * Only grow the pool if the job can start right away, i.e. no
+         * earlier job of the same client is still pending.
+         */
+        if (!queue->nr_idle && queue->nr_threads < VNC_JOBS_MAX_WORKERS &&
+            !vnc_has_job_locked(job->vs)) {
+            vnc_start_worker_locked(queue);
+        }
         QTAILQ_INSERT_TAIL(&queue->jobs, job, next);
         qemu_cond_broadcast(&queue->cond);
     }
@@ -139,11 +160,17 @@ bool vnc_has_job(VncState *vs)
 void vnc_jobs_clear(VncState *vs)
 {
     VncJob *job, *tmp;
+    VncRectEntry *entry, *etmp;
 
     vnc_lock_queue(queue);
     QTAILQ_FOREACH_SAFE(job, &queue->jobs, next, tmp) {
-        if (job->vs == vs || !vs) {
+        /* Running jobs are removed by their worker thread */
+        if ((job->vs == vs || !vs) && !job->running) {
             QTAILQ_REMOVE(&queue->jobs, job, next);
+            QLIST_FOREACH_SAFE(entry, &job->rectangles, next, etmp) {
+                g_free(entry);
+            }
+            g_free(job);
         }
     }
     vnc_unlock_queue(queue);
@@ -170,6 +197,7 @@ void vnc_jobs_consume_buffer(VncState *vs)
                                 vnc_client_write, vs);
         }
         buffer_move(&vs->output, &vs->jobs_buffer);
+        vnc_link_update_queued(vs);
 
         if (vs->job_update == VNC_STATE_UPDATE_FORCE) {
             vs->force_update_offset = vs->output.offset;
@@ -197,6 +225,11 @@ static void vnc_async_encoding_start(VncState *orig, VncState *local)
     local->client_pf = orig->client_pf;
     local->client_be = orig->client_be;
     local->tight = orig->tight;
+    /* Lossy quality requested by the client, limited by the link */
+    if (local->tight.quality != (uint8_t)-1 &&
+        local->tight.quality > orig->link.quality_cap) {
+        local->tight.quality = orig->link.quality_cap;
+    }
     local->zlib = orig->zlib;
     local->hextile = orig->hextile;
     local->zrle = orig->zrle;
@@ -205,32 +238,61 @@ static void vnc_async_encoding_start(VncState *orig, VncState *local)
 
 static void vnc_async_encoding_end(VncState *orig, VncState *local)
 {
+    uint8_t quality = orig->tight.quality;
+
     orig->tight = local->tight;
+    orig->tight.quality = quality;
     orig->zlib = local->zlib;
     orig->hextile = local->hextile;
     orig->zrle = local->zrle;
     orig->lossy_rect = local->lossy_rect;
 }
 
+/*
+ * Return the oldest job that no other worker is busy with and whose client
+ * has no older job still queued or running.
+ */
+static VncJob *vnc_queue_next_job_locked(VncJobQueue *queue)
+{
+    VncJob *job, *prev;
+
+    QTAILQ_FOREACH(job, &queue->jobs, next) {
+        if (job->running) {
+            continue;
+        }
+        QTAILQ_FOREACH(prev, &queue->jobs, next) {
+            if (prev == job || prev->vs == job->vs) {
+                break;
+            }
+        }
+        if (prev == job) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
 static int vnc_worker_thread_loop(VncJobQueue *queue)
 {
-    VncJob *job;
+    VncJob *job = NULL;
     VncRectEntry *entry, *tmp;
     VncState vs;
     int n_rectangles;
     int saved_offset;
+    int64_t encode_ns;
 
     vnc_lock_queue(queue);
-    while (QTAILQ_EMPTY(&queue->jobs) && !queue->exit) {
+    queue->nr_idle++;
+    while (!queue->exit && !(job = vnc_queue_next_job_locked(queue))) {
         qemu_cond_wait(&queue->cond, &queue->mutex);
     }
-    /* Here job can only be NULL if queue->exit is true */
-    job = QTAILQ_FIRST(&queue->jobs);
-    vnc_unlock_queue(queue);
-
+    queue->nr_idle--;
     if (queue->exit) {
+        vnc_unlock_queue(queue);
         return -1;
     }
+    job->running = true;
+    vnc_unlock_queue(queue);
 
     vnc_lock_output(job->vs);
     if (job->vs->csock == -1 || job->vs->abort == true) {
@@ -249,12 +311,13 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     saved_offset = vs.output.offset;
     vnc_write_u16(&vs, 0);
 
-    vnc_lock_display(job->vs->vd);
+    encode_ns = qemu_get_clock_ns(rt_clock);
+    vnc_lock_display_shared(job->vs->vd);
     QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
         int n;
 
         if (job->vs->csock == -1) {
-            vnc_unlock_display(job->vs->vd);
+            vnc_unlock_display_shared(job->vs->vd);
             /* Copy persistent encoding data */
             vnc_async_encoding_end(job->vs, &vs);
             goto disconnected;
@@ -266,9 +329,11 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
         if (n >= 0) {
             n_rectangles += n;
         }
+        QLIST_REMOVE(entry, next);
         g_free(entry);
     }
-    vnc_unlock_display(job->vs->vd);
+    vnc_unlock_display_shared(job->vs->vd);
+    encode_ns = qemu_get_clock_ns(rt_clock) - encode_ns;
 
     /* Put n_rectangles at the beginning of the message */
     vs.output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
@@ -276,6 +341,7 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
 
     vnc_lock_output(job->vs);
     if (job->vs->csock != -1) {
+        job->vs->link.encode_ns = (job->vs->link.encode_ns * 3 + encode_ns) / 4;
         buffer_move(&job->vs->jobs_buffer, &vs.output);
         /* Copy persistent encoding data */
         vnc_async_encoding_end(job->vs, &vs);
@@ -292,7 +358,11 @@ disconnected:
     vnc_lock_queue(queue);
     QTAILQ_REMOVE(&queue->jobs, job, next);
     vnc_unlock_queue(queue);
+    /* Wakes up both vnc_jobs_join() and workers waiting on this client */
     qemu_cond_broadcast(&queue->cond);
+    QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
+        g_free(entry);
+    }
     g_free(job);
     return 0;
 }
@@ -318,14 +388,28 @@ static void vnc_queue_clear(VncJobQueue *q)
 static void *vnc_worker_thread(void *arg)
 {
     VncJobQueue *queue = arg;
-
-    qemu_thread_get_self(&queue->thread);
+    bool last;
 
     while (!vnc_worker_thread_loop(queue)) ;
-    vnc_queue_clear(queue);
+
+    vnc_lock_queue(queue);
+    last = --queue->nr_threads == 0;
+    vnc_unlock_queue(queue);
+    if (last) {
+        vnc_queue_clear(queue);
+    }
     return NULL;
 }
 
+static void vnc_start_worker_locked(VncJobQueue *queue)
+{
+    QemuThread thread;
+
+    queue->nr_threads++;
+    qemu_thread_create(&thread, vnc_worker_thread, queue,
+                       QEMU_THREAD_DETACHED);
+}
+
 static bool vnc_worker_thread_running(void)
 {
     return queue; /* Check global queue */
@@ -339,7 +423,9 @@ void vnc_start_worker_thread(void)
         return ;
 
     q = vnc_queue_init();
-    qemu_thread_create(&q->thread, vnc_worker_thread, q, QEMU_THREAD_DETACHED);
+    vnc_lock_queue(q);
+    vnc_start_worker_locked(q);
+    vnc_unlock_queue(q);
     queue = q; /* Set global queue */
 }
 
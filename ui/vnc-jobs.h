@@ -43,18 +43,41 @@ void vnc_start_worker_thread(void);
 void vnc_stop_worker_thread(void);
 
 /* Locks */
+
+/*
+ * The display lock is taken exclusively by vnc_refresh() when it updates
+ * the server surface, and shared by the worker threads that only read it
+ * while encoding.  vd->mutex protects vd->readers; the exclusive side keeps
+ * vd->mutex held, which stops new readers from coming in.
+ */
 static inline int vnc_trylock_display(VncDisplay *vd)
 {
-    return qemu_mutex_trylock(&vd->mutex);
+    if (qemu_mutex_trylock(&vd->mutex)) {
+        return -1;
+    }
+    if (vd->readers) {
+        qemu_mutex_unlock(&vd->mutex);
+        return -1;
+    }
+    return 0;
 }
 
-static inline void vnc_lock_display(VncDisplay *vd)
+static inline void vnc_unlock_display(VncDisplay *vd)
+{
+    qemu_mutex_unlock(&vd->mutex);
+}
+
+static inline void vnc_lock_display_shared(VncDisplay *vd)
 {
     qemu_mutex_lock(&vd->mutex);
+    vd->readers++;
+    qemu_mutex_unlock(&vd->mutex);
 }
 
-static inline void vnc_unlock_display(VncDisplay *vd)
+static inline void vnc_unlock_display_shared(VncDisplay *vd)
 {
+    qemu_mutex_lock(&vd->mutex);
+    vd->readers--;
     qemu_mutex_unlock(&vd->mutex);
 }
 
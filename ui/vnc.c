@@ -38,6 +38,11 @@
 #define VNC_REFRESH_INTERVAL_INC  50
 #define VNC_REFRESH_INTERVAL_MAX  GUI_REFRESH_INTERVAL_IDLE
 static const struct timeval VNC_REFRESH_STATS = { 0, 500000 };
+
+/* Drains smaller than this say more about latency than about bandwidth */
+#define VNC_LINK_MIN_SAMPLE       (16 * 1024)
+/* Quality is lowered when an update takes longer than this to deliver */
+#define VNC_LINK_SLOW_NS          (VNC_REFRESH_INTERVAL_BASE * SCALE_MS)
 static const struct timeval VNC_REFRESH_LOSSY = { 2, 0 };
 
 #include "vnc_keysym.h"
@@ -962,6 +967,13 @@ static int vnc_update_client(VncState *vs, int has_dirty)
         return 0;
     }
 
+    /* Don't encode frames faster than the link or the CPU limit allow;
+     * the dirty bits simply accumulate until the next pass. */
+    if (vs->update != VNC_STATE_UPDATE_FORCE &&
+        qemu_get_clock_ns(rt_clock) < vs->link.next_update_ns) {
+        return 0;
+    }
+
     /*
      * Send screen updates to the vnc client using the server
      * surface and server dirty map.  guest surface updates
@@ -1279,6 +1291,84 @@ static long vnc_client_write_plain(VncState *vs)
 }
 
 
+static size_t vnc_output_pending(VncState *vs)
+{
+    size_t pending = vs->output.offset;
+#ifdef CONFIG_VNC_WS
+    pending += vs->ws_output.offset;
+#endif
+    return pending;
+}
+
+/*
+ * Estimate the client's throughput from the time it takes to drain the
+ * output backlog.  A backlog that drains without ever blocking gives a
+ * sample of at least VNC_LINK_MIN_SAMPLE per millisecond, so the estimate
+ * recovers quickly once the link gets faster again.
+ */
+static void vnc_link_account_write(VncState *vs, size_t before)
+{
+    VncLinkStats *link = &vs->link;
+    size_t after = vnc_output_pending(vs);
+    int64_t elapsed;
+    uint64_t sample;
+
+    if (after < before) {
+        link->bytes += before - after;
+    }
+    if (after) {
+        return;
+    }
+
+    elapsed = MAX(qemu_get_clock_ns(rt_clock) - link->start_ns, SCALE_MS);
+    if (link->bytes >= VNC_LINK_MIN_SAMPLE) {
+        sample = (uint64_t)link->bytes * get_ticks_per_sec() / elapsed;
+        if (link->bandwidth) {
+            link->bandwidth = (link->bandwidth * 3 + sample) / 4;
+        } else {
+            link->bandwidth = sample;
+        }
+    }
+    link->start_ns = 0;
+    link->bytes = 0;
+}
+
+/*
+ * Called with the output lock held when an encoded update is
+ * appended to the output buffer.  Picks the earliest time for the next
+ * incremental update and adapts the JPEG quality to the link.
+ */
+void vnc_link_update_queued(VncState *vs)
+{
+    VncLinkStats *link = &vs->link;
+    VncDisplay *vd = vs->vd;
+    int64_t delay = 0;
+
+    if (!vd->non_adaptive && link->bandwidth) {
+        /* Time to push this update and the backlog in front of it */
+        delay = (uint64_t)vnc_output_pending(vs) * get_ticks_per_sec() /
+                link->bandwidth;
+        if (delay > VNC_LINK_SLOW_NS) {
+            if (link->quality_cap > 0) {
+                link->quality_cap--;
+            }
+        } else if (delay < VNC_LINK_SLOW_NS / 4) {
+            if (link->quality_cap < 9) {
+                link->quality_cap++;
+            }
+        }
+    }
+
+    if (vd->cpu_limit) {
+        /* encode / (encode + idle) <= cpu_limit% */
+        delay = MAX(delay, link->encode_ns * (100 - vd->cpu_limit) /
+                           vd->cpu_limit);
+    }
+
+    delay = MIN(delay, (int64_t)VNC_REFRESH_INTERVAL_MAX * SCALE_MS);
+    link->next_update_ns = qemu_get_clock_ns(rt_clock) + delay;
+}
+
 /*
  * First function called whenever there is data to be written to
  * the client socket. Will delegate actual work according to whether
@@ -1287,6 +1377,11 @@ static long vnc_client_write_plain(VncState *vs)
 static void vnc_client_write_locked(void *opaque)
 {
     VncState *vs = opaque;
+    size_t pending = vnc_output_pending(vs);
+
+    if (!vs->link.start_ns) {
+        vs->link.start_ns = qemu_get_clock_ns(rt_clock);
+    }
 
 #ifdef CONFIG_VNC_SASL
     if (vs->sasl.conn &&
@@ -1305,6 +1400,8 @@ static void vnc_client_write_locked(void *opaque)
             vnc_client_write_plain(vs);
         }
     }
+
+    vnc_link_account_write(vs, pending);
 }
 
 void vnc_client_write(void *opaque)
@@ -2841,10 +2938,9 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
                 _cmp_bytes = line_bytes - x * cmp_bytes;
             }
             assert(_cmp_bytes >= 0);
-            if (memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
+            if (!dpy_cmp_copy(server_ptr, guest_ptr, _cmp_bytes)) {
                 continue;
             }
-            memcpy(server_ptr, guest_ptr, _cmp_bytes);
             if (!vd->non_adaptive) {
                 vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
                                  y, &tv);
@@ -2923,6 +3019,7 @@ static void vnc_connect(VncDisplay *vd, int csock, int skipauth, bool websocket)
     for (i = 0; i < VNC_STAT_ROWS; ++i) {
         vs->lossy_rect[i] = g_malloc0(VNC_STAT_COLS * sizeof (uint8_t));
     }
+    vs->link.quality_cap = 9;
 
     VNC_DEBUG("New client on socket %d\n", csock);
     update_displaychangelistener(&vd->dcl, VNC_REFRESH_INTERVAL_BASE);
@@ -3281,6 +3378,16 @@ void vnc_display_open(DisplayState *ds, const char *display, Error **errp)
             vs->lossy = true;
         } else if (strncmp(options, "non-adaptive", 12) == 0) {
             vs->non_adaptive = true;
+        } else if (strncmp(options, "cpu-limit=", 10) == 0) {
+            char *end;
+            long limit = strtol(options + 10, &end, 10);
+
+            if (end == options + 10 || (*end && *end != ',') ||
+                limit < 1 || limit > 100) {
+                error_setg(errp, "vnc cpu-limit= must be between 1 and 100");
+                goto fail;
+            }
+            vs->cpu_limit = limit;
         } else if (strncmp(options, "share=", 6) == 0) {
             if (strncmp(options+6, "ignore", 6) == 0) {
                 vs->share_policy = VNC_SHARE_POLICY_IGNORE;
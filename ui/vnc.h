@@ -163,6 +163,7 @@ struct VncDisplay
     kbd_layout_t *kbd_layout;
     int lock_key_sync;
     QemuMutex mutex;
+    int readers;            /* encoding jobs reading the server surface */
 
     QEMUCursor *cursor;
     int cursor_msize;
@@ -177,6 +178,7 @@ struct VncDisplay
     int auth;
     bool lossy;
     bool non_adaptive;
+    int cpu_limit;          /* max % of a host CPU spent encoding per client */
 #ifdef CONFIG_VNC_TLS
     int subauth; /* Used by VeNCrypt */
     VncDisplayTLS tls;
@@ -247,11 +249,27 @@ struct VncRectEntry
 struct VncJob
 {
     VncState *vs;
+    bool running;           /* picked up by a worker thread */
 
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
 };
 
+/*
+ * Per client link estimates, used to pace incremental updates and to cap
+ * the Tight JPEG quality to what the connection can carry.  Written by the
+ * main loop with the output lock held, except encode_ns which is written
+ * by the worker thread under the same lock.
+ */
+typedef struct VncLinkStats {
+    int64_t start_ns;       /* first write of the current output backlog */
+    size_t bytes;           /* bytes written since start_ns */
+    uint64_t bandwidth;     /* estimated throughput, bytes per second */
+    int64_t encode_ns;      /* average time spent encoding one update */
+    int64_t next_update_ns; /* no incremental update before this time */
+    uint8_t quality_cap;    /* upper bound on vs->tight.quality */
+} VncLinkStats;
+
 typedef enum {
     VNC_STATE_UPDATE_NONE,
     VNC_STATE_UPDATE_INCREMENTAL,
@@ -314,6 +332,7 @@ struct VncState
      * is calculating dynamically based on framebuffer size
      * and audio sample settings in vnc_update_throttle_offset() */
     size_t throttle_output_offset;
+    VncLinkStats link;
     Buffer output;
     Buffer input;
 #ifdef CONFIG_VNC_WS
@@ -594,6 +613,7 @@ int vnc_server_fb_stride(VncDisplay *vd);
 
 void vnc_convert_pixel(VncState *vs, uint8_t *buf, uint32_t v);
 double vnc_update_freq(VncState *vs, int x, int y, int w, int h);
+void vnc_link_update_queued(VncState *vs);
 void vnc_sent_lossy_rect(VncState *vs, int x, int y, int w, int h);
 
 /* Encodings */
@@ -15,6 +15,7 @@
 #include "qemu/osdep.h"
 #include "qemu/hbitmap.h"
 #include "qemu/host-utils.h"
+#include "qemu/bswap.h"
 #include "trace.h"
 
 /* HBitmaps provides an array of bits.  The bits are stored as usual in an
@@ -243,15 +244,17 @@ static void hb_set_between(HBitmap *hb, int level, uint64_t start, uint64_t last
     if (i < lastpos) {
         uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
         changed |= hb_set_elem(&hb->levels[level][i], start, next - 1);
-        for (;;) {
-            start = next;
-            next += BITS_PER_LONG;
-            if (++i == lastpos) {
-                break;
-            }
-            changed |= (hb->levels[level][i] == 0);
-            hb->levels[level][i] = ~0UL;
+        if (++i < lastpos) {
+            /* Fill whole words at once.  Their bits in the upper level
+             * must end up set whatever their previous value was, so
+             * there is no need to look at them first.
+             */
+            memset(&hb->levels[level][i], 0xff,
+                   (lastpos - i) * sizeof(unsigned long));
+            changed = true;
         }
+        i = lastpos;
+        start = (uint64_t)lastpos << BITS_PER_LEVEL;
     }
     changed |= hb_set_elem(&hb->levels[level][i], start, last);
 
@@ -320,15 +323,14 @@ static void hb_reset_between(HBitmap *hb, int level, uint64_t start, uint64_t la
             pos++;
         }
 
-        for (;;) {
-            start = next;
-            next += BITS_PER_LONG;
-            if (++i == lastpos) {
-                break;
-            }
-            changed |= (hb->levels[level][i] != 0);
-            hb->levels[level][i] = 0UL;
+        if (++i < lastpos) {
+            /* Whole words: same reasoning as in hb_set_between.  */
+            memset(&hb->levels[level][i], 0,
+                   (lastpos - i) * sizeof(unsigned long));
+            changed = true;
         }
+        i = lastpos;
+        start = (uint64_t)lastpos << BITS_PER_LEVEL;
     }
 
     /* Same as above, this time for lastpos.  */
@@ -358,6 +360,19 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
     hb_reset_between(hb, HBITMAP_LEVELS - 1, start, last);
 }
 
+void hbitmap_reset_all(HBitmap *hb)
+{
+    uint64_t size = hb->size;
+    unsigned i;
+
+    for (i = HBITMAP_LEVELS; i-- > 0; ) {
+        size = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
+        memset(hb->levels[i], 0, size * sizeof(unsigned long));
+    }
+    hb->levels[0][0] |= 1UL << (BITS_PER_LONG - 1);
+    hb->count = 0;
+}
+
 bool hbitmap_get(const HBitmap *hb, uint64_t item)
 {
     /* Compute position and bit in the last layer.  */
@@ -367,6 +382,177 @@ bool hbitmap_get(const HBitmap *hb, uint64_t item)
     return (hb->levels[HBITMAP_LEVELS - 1][pos >> BITS_PER_LEVEL] & bit) != 0;
 }
 
+bool hbitmap_merge(HBitmap *a, const HBitmap *b)
+{
+    HBitmapIter hbi;
+    unsigned long *elem;
+    unsigned long cur;
+    size_t pos;
+
+    if (a->size != b->size || a->granularity != b->granularity) {
+        return false;
+    }
+    if (hbitmap_empty(b)) {
+        return true;
+    }
+
+    /* Only visit the nonzero words of b; a word of a that goes from
+     * zero to nonzero is propagated to the upper levels.
+     */
+    hbitmap_iter_init(&hbi, b, 0);
+    for (;;) {
+        pos = hbitmap_iter_next_word(&hbi, &cur);
+        if (cur == 0) {
+            break;
+        }
+        elem = &a->levels[HBITMAP_LEVELS - 1][pos];
+        a->count += popcountl(cur & ~*elem);
+        if (*elem == 0) {
+            hb_set_between(a, HBITMAP_LEVELS - 2, pos, pos);
+        }
+        *elem |= cur;
+    }
+    return true;
+}
+
+uint64_t hbitmap_serialization_granularity(const HBitmap *hb)
+{
+    /* Serialize in units of 64 bits, so that the format does not
+     * depend on the host's word size.
+     */
+    return UINT64_C(64) << hb->granularity;
+}
+
+/* Return the range of 64-bit serialization units covered by
+ * [start, start + count), which must be aligned to the serialization
+ * granularity except at the end of the bitmap.
+ */
+static void serialization_chunk(const HBitmap *hb,
+                                uint64_t start, uint64_t count,
+                                uint64_t *first_unit, uint64_t *unit_count)
+{
+    uint64_t last = start + count - 1;
+    uint64_t gran = hbitmap_serialization_granularity(hb);
+
+    assert((start & (gran - 1)) == 0);
+    assert((last >> hb->granularity) < hb->size);
+    if ((last >> hb->granularity) != hb->size - 1) {
+        assert((count & (gran - 1)) == 0);
+    }
+
+    start = (start >> hb->granularity) >> 6;
+    last = (last >> hb->granularity) >> 6;
+
+    *first_unit = start;
+    *unit_count = last - start + 1;
+}
+
+/* Number of words in the bottom level.  On 32-bit hosts it can be odd,
+ * in which case the last serialization unit only has a low half.
+ */
+static size_t hb_bottom_words(const HBitmap *hb)
+{
+    return MAX((hb->size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
+}
+
+uint64_t hbitmap_serialization_size(const HBitmap *hb,
+                                    uint64_t start, uint64_t count)
+{
+    uint64_t first, units;
+
+    if (!count) {
+        return 0;
+    }
+    serialization_chunk(hb, start, count, &first, &units);
+    return units * sizeof(uint64_t);
+}
+
+void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
+                            uint64_t start, uint64_t count)
+{
+    const unsigned long *el = hb->levels[HBITMAP_LEVELS - 1];
+    size_t n = hb_bottom_words(hb);
+    uint64_t first, units, i, w, val;
+
+    if (!count) {
+        return;
+    }
+    serialization_chunk(hb, start, count, &first, &units);
+    for (i = 0; i < units; i++) {
+        if (BITS_PER_LONG == 32) {
+            w = (first + i) * 2;
+            val = (uint32_t)el[w];
+            if (w + 1 < n) {
+                val |= (uint64_t)el[w + 1] << 32;
+            }
+        } else {
+            val = el[first + i];
+        }
+        stq_le_p(buf + i * sizeof(uint64_t), val);
+    }
+}
+
+void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
+                              uint64_t start, uint64_t count,
+                              bool finish)
+{
+    unsigned long *el = hb->levels[HBITMAP_LEVELS - 1];
+    size_t n = hb_bottom_words(hb);
+    uint64_t first, units, i, w, val;
+
+    if (count) {
+        serialization_chunk(hb, start, count, &first, &units);
+        for (i = 0; i < units; i++) {
+            val = ldq_le_p(buf + i * sizeof(uint64_t));
+            if (BITS_PER_LONG == 32) {
+                w = (first + i) * 2;
+                el[w] = (uint32_t)val;
+                if (w + 1 < n) {
+                    el[w + 1] = val >> 32;
+                }
+            } else {
+                el[first + i] = val;
+            }
+        }
+    }
+    if (finish) {
+        hbitmap_deserialize_finish(hb);
+    }
+}
+
+void hbitmap_deserialize_finish(HBitmap *hb)
+{
+    uint64_t size = hb->size;
+    unsigned long *bottom = hb->levels[HBITMAP_LEVELS - 1];
+    size_t i, n, upper;
+    int level;
+
+    /* Drop any bits past the end of the bitmap.  */
+    n = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
+    if (size & (BITS_PER_LONG - 1)) {
+        bottom[n - 1] &= (1UL << (size & (BITS_PER_LONG - 1))) - 1;
+    }
+
+    hb->count = 0;
+    for (i = 0; i < n; i++) {
+        hb->count += popcountl(bottom[i]);
+    }
+
+    /* Rebuild the upper levels from the bottom one.  */
+    for (level = HBITMAP_LEVELS - 1; level > 0; level--) {
+        upper = MAX((n + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
+        memset(hb->levels[level - 1], 0, upper * sizeof(unsigned long));
+        for (i = 0; i < n; i++) {
+            if (hb->levels[level][i]) {
+                hb->levels[level - 1][i >> BITS_PER_LEVEL] |=
+                    1UL << (i & (BITS_PER_LONG - 1));
+            }
+        }
+        n = upper;
+    }
+    hb->levels[0][0] |= 1UL << (BITS_PER_LONG - 1);
+}
+
 void hbitmap_free(HBitmap *hb)
 {
     unsigned i;
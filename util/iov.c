@@ -262,9 +262,14 @@ unsigned iov_copy(struct iovec *dst_iov, unsigned int dst_iov_cnt,
 
 void qemu_iovec_init(QEMUIOVector *qiov, int alloc_hint)
 {
-    qiov->iov = g_malloc(alloc_hint * sizeof(struct iovec));
+    if (alloc_hint <= QEMU_IOVEC_INLINE) {
+        qiov->iov = qiov->inline_iov;
+        qiov->nalloc = QEMU_IOVEC_INLINE;
+    } else {
+        qiov->iov = g_malloc(alloc_hint * sizeof(struct iovec));
+        qiov->nalloc = alloc_hint;
+    }
     qiov->niov = 0;
-    qiov->nalloc = alloc_hint;
     qiov->size = 0;
 }
 
@@ -286,7 +291,14 @@ void qemu_iovec_add(QEMUIOVector *qiov, void *base, size_t len)
 
     if (qiov->niov == qiov->nalloc) {
         qiov->nalloc = 2 * qiov->nalloc + 1;
-        qiov->iov = g_realloc(qiov->iov, qiov->nalloc * sizeof(struct iovec));
+        if (qiov->iov == qiov->inline_iov) {
+            qiov->iov = g_malloc(qiov->nalloc * sizeof(struct iovec));
+            memcpy(qiov->iov, qiov->inline_iov,
+                   qiov->niov * sizeof(struct iovec));
+        } else {
+            qiov->iov = g_realloc(qiov->iov,
+                                  qiov->nalloc * sizeof(struct iovec));
+        }
     }
     qiov->iov[qiov->niov].iov_base = base;
     qiov->iov[qiov->niov].iov_len = len;
@@ -349,7 +361,9 @@ void qemu_iovec_destroy(QEMUIOVector *qiov)
     assert(qiov->nalloc != -1);
 
     qemu_iovec_reset(qiov);
-    g_free(qiov->iov);
+    if (qiov->iov != qiov->inline_iov) {
+        g_free(qiov->iov);
+    }
     qiov->nalloc = 0;
     qiov->iov = NULL;
 }
@@ -166,6 +166,7 @@ int main(int argc, char **argv)
 #include "qemu/queue.h"
 #include "sysemu/cpus.h"
 #include "sysemu/arch_init.h"
+#include "sysemu/stats-shm.h"
 #include "qemu/osdep.h"
 
 #include "ui/qemu-spice.h"
@@ -270,6 +271,7 @@ bool xen_allowed;
 uint32_t xen_domid;
 enum xen_mode xen_mode = XEN_EMULATE;
 static int tcg_tb_size;
+static bool perf_map;
 
 static int default_serial = 1;
 static int default_parallel = 1;
@@ -521,6 +523,25 @@ static QemuOptsList qemu_realtime_opts = {
     },
 };
 
+static QemuOptsList qemu_stats_shm_opts = {
+    .name = "stats-shm",
+    .implied_opt_name = "path",
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_stats_shm_opts.head),
+    .desc = {
+        {
+            .name = "path",
+            .type = QEMU_OPT_STRING,
+        }, {
+            .name = "interval",
+            .type = QEMU_OPT_NUMBER,
+        }, {
+            .name = "records",
+            .type = QEMU_OPT_NUMBER,
+        },
+        { /* end of list */ }
+    },
+};
+
 static QemuOptsList qemu_msg_opts = {
     .name = "msg",
     .head = QTAILQ_HEAD_INITIALIZER(qemu_msg_opts.head),
@@ -2861,6 +2882,7 @@ int main(int argc, char **argv, char **envp)
     qemu_add_opts(&qemu_tpmdev_opts);
     qemu_add_opts(&qemu_realtime_opts);
     qemu_add_opts(&qemu_msg_opts);
+    qemu_add_opts(&qemu_stats_shm_opts);
 
     runstate_init();
 
@@ -3649,6 +3671,9 @@ int main(int argc, char **argv, char **envp)
                     tcg_tb_size = 0;
                 }
                 break;
+            case QEMU_OPTION_perfmap:
+                perf_map = true;
+                break;
             case QEMU_OPTION_icount:
                 icount_option = optarg;
                 break;
@@ -3781,6 +3806,20 @@ int main(int argc, char **argv, char **envp)
                 }
                 configure_msg(opts);
                 break;
+#ifdef CONFIG_POSIX
+            case QEMU_OPTION_stats_shm:
+                if (qemu_opts_find(qemu_find_opts("stats-shm"), NULL)) {
+                    fprintf(stderr, "qemu: only one -stats-shm option "
+                            "may be given\n");
+                    exit(1);
+                }
+                opts = qemu_opts_parse(qemu_find_opts("stats-shm"),
+                                       optarg, 1);
+                if (!opts) {
+                    exit(1);
+                }
+                break;
+#endif
             case QEMU_OPTION_dump_vmstate:
                 vmstate_dump_file = fopen(optarg, "w");
                 if (vmstate_dump_file == NULL) {
@@ -4019,6 +4058,11 @@ int main(int argc, char **argv, char **envp)
         exit(1);
     }
 
+    /* the map is named after the pid, so wait for -daemonize to fork */
+    if (perf_map) {
+        tb_perf_map_enable();
+    }
+
     /* init the memory */
     if (ram_size == 0) {
         ram_size = DEFAULT_RAM_SIZE * 1024 * 1024;
@@ -4261,6 +4305,13 @@ int main(int argc, char **argv, char **envp)
 
     net_check_clients();
 
+#ifdef CONFIG_POSIX
+    opts = qemu_opts_find(qemu_find_opts("stats-shm"), NULL);
+    if (opts && stats_shm_init(opts) < 0) {
+        exit(1);
+    }
+#endif
+
     ds = init_displaystate();
 
     /* init local displays */